@@ -0,0 +1,565 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ui.h"
+
+#define MIN(X, Y) ((X) < (Y) ? (X) : (Y))
+
+/* Times the parts of the library whose cost depends on the size of the UI:
+ * the size and walk of the commands, ordering the blocks of many windows,
+ * hashing IDs, the input handling of many widgets and column layouts, and
+ * counts the batches left by GroupCommands and the widget states kept. Pass the names of the benchmarks to run,
+ * all of them run without arguments. Times are the best of a few runs. */
+
+double
+Now(void) {
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return Time.tv_sec * 1e6 + Time.tv_nsec * 1e-3;
+}
+
+int
+TextWidth(char *Text) {
+    return (int)strlen(Text) * 7;
+}
+
+void
+InitContext(ui_context *Ctx, ui_rect Viewport) {
+    memset(Ctx, 0, sizeof(ui_context));
+    Ctx->TextHeight = 14;
+    Ctx->TextWidth = TextWidth;
+    Ctx->Viewport = Viewport;
+}
+
+/* Places a window so the benchmark doesn't depend on the default size */
+void
+PlaceWindow(ui_context *Ctx, char *Name, ui_rect Rect) {
+    ui_window *Window = UI_FindWindow(Ctx, UI_HashString(Name));
+    Window->Rect = Rect;
+    Window->Title = UI_Rect(Rect.x, Rect.y + Rect.h - Window->Title.h, Rect.w, Window->Title.h);
+    Window->Body = UI_Rect(Rect.x, Rect.y, Rect.w, Rect.h - Window->Title.h);
+}
+
+/* 40 windows of 12 rows of 8 buttons and 4 texts, about 10k commands. The
+ * commands are walked with UI_NextCommand, by block with UI_NextBlock and
+ * as an array of ui_command like before commands were packed, where every
+ * command takes the size of the union. */
+static char CommandLabels[100][16];
+
+void
+CommandsFrame(ui_context *Ctx) {
+    char Name[32];
+    UI_Begin(Ctx);
+    for(int w = 0; w < 40; w++) {
+        sprintf(Name, "cmds%d", w);
+        if(UI_Window(Ctx, Name, w * 5, 100)) {
+            for(int Row = 0; Row < 12; Row++) {
+                UI_Inline(Ctx);
+                for(int i = 0; i < 8; i++) {
+                    UI_Button(Ctx, CommandLabels[Row * 8 + i]);
+                }
+                UI_Inline(Ctx);
+                UI_Inline(Ctx);
+                for(int i = 0; i < 4; i++) {
+                    UI_Text(Ctx, CommandLabels[Row * 4 + i], UI_Color(255, 255, 255, 255));
+                }
+                UI_Inline(Ctx);
+            }
+        }
+        UI_EndWindow(Ctx);
+    }
+    UI_End(Ctx);
+}
+
+/* The work a renderer does per command, reading the type and the rect */
+int
+VisitCommand(ui_command *Cmd) {
+    switch(Cmd->Type) {
+        case UI_COMMAND_RECT: return Cmd->Rect.Rect.x + Cmd->Rect.Color.r;
+        case UI_COMMAND_TEXT: return Cmd->Text.Rect.x + Cmd->Text.Length;
+        case UI_COMMAND_ICON: return Cmd->Icon.Rect.x + Cmd->Icon.ID;
+        case UI_COMMAND_PUSH_CLIP:
+        case UI_COMMAND_CLIP: return Cmd->Clip.Rect.w;
+        default: return 1;
+    }
+}
+
+volatile int IntSink;
+
+void
+BenchCommands(void) {
+    static ui_context Ctx;
+    char Name[32];
+    for(int i = 0; i < 100; i++) {
+        sprintf(CommandLabels[i], "label %d", i);
+    }
+    InitContext(&Ctx, UI_Rect(0, 0, 4000, 4000));
+    CommandsFrame(&Ctx);
+    for(int w = 0; w < 40; w++) {
+        sprintf(Name, "cmds%d", w);
+        PlaceWindow(&Ctx, Name, UI_Rect((w % 8) * 500, (w / 8) * 800, 500, 800));
+    }
+    CommandsFrame(&Ctx);
+
+    int Count = 0, Bytes = 0;
+    ui_command_block *Block;
+    while(UI_NextBlock(&Ctx, &Block)) {
+        Count += Block->CommandCount;
+        Bytes += Block->Size;
+    }
+    ui_command *Array = malloc(Count * sizeof(ui_command));
+    ui_command *Cmd;
+    for(int i = 0; UI_NextCommand(&Ctx, &Cmd); i++) {
+        memcpy(&Array[i], Cmd, Cmd->Header.Size);
+    }
+
+    int Reps = 200;
+    double Packed = 1e30, Blocks = 1e30, Fat = 1e30;
+    for(int Run = 0; Run < 5; Run++) {
+        double Start = Now();
+        for(int r = 0; r < Reps; r++) {
+            int Sum = 0;
+            Ctx.CmdRefIndex = 0;
+            Ctx.CmdOffset = 0;
+            while(UI_NextCommand(&Ctx, &Cmd)) {
+                Sum += VisitCommand(Cmd);
+            }
+            IntSink = Sum;
+        }
+        Packed = MIN(Packed, (Now() - Start) / Reps);
+
+        Start = Now();
+        for(int r = 0; r < Reps; r++) {
+            int Sum = 0;
+            Ctx.BlockRefIndex = 0;
+            while(UI_NextBlock(&Ctx, &Block)) {
+                for(Cmd = UI_BLOCK_BEGIN(Block); Cmd < UI_BLOCK_END(Block); Cmd = UI_NEXT_COMMAND(Cmd)) {
+                    Sum += VisitCommand(Cmd);
+                }
+            }
+            IntSink = Sum;
+        }
+        Blocks = MIN(Blocks, (Now() - Start) / Reps);
+
+        Start = Now();
+        for(int r = 0; r < Reps; r++) {
+            int Sum = 0;
+            for(int i = 0; i < Count; i++) {
+                Sum += VisitCommand(&Array[i]);
+            }
+            IntSink = Sum;
+        }
+        Fat = MIN(Fat, (Now() - Start) / Reps);
+    }
+    printf("commands: %d commands, packed %d bytes/frame, walk %.1f us (UI_NextCommand), %.1f us (UI_NextBlock)\n",
+           Count, Bytes, Packed, Blocks);
+    printf("commands: %d commands, ui_command array %d bytes/frame, walk %.1f us\n",
+           Count, (int)(Count * sizeof(ui_command)), Fat);
+    free(Array);
+    UI_Release(&Ctx);
+}
+
+/* UI_OrderCommandRefs with N windows created bottom to top. The references
+ * are put back after it so UI_End orders them again. */
+void
+BenchOrder(void) {
+    static int Counts[] = {32, 1000, 10000};
+    static ui_context Ctx;
+    static ui_command_ref Refs[10000];
+    char Name[32];
+    for(int i = 0; i < 3; i++) {
+        InitContext(&Ctx, UI_Rect(0, 0, 0, 0));
+        double Best = 1e30;
+        for(int Run = 0; Run < 5; Run++) {
+            UI_Begin(&Ctx);
+            for(int w = 0; w < Counts[i]; w++) {
+                sprintf(Name, "w%d", w);
+                UI_Window(&Ctx, Name, w, 300);
+                UI_EndWindow(&Ctx);
+            }
+            unsigned int Index = Ctx.CommandRefStack.Index;
+            memcpy(Refs, Ctx.CommandRefStack.Items, Index * sizeof(ui_command_ref));
+            double Start = Now();
+            UI_OrderCommandRefs(&Ctx);
+            Best = MIN(Best, Now() - Start);
+            memcpy(Ctx.CommandRefStack.Items, Refs, Index * sizeof(ui_command_ref));
+            Ctx.CommandRefStack.Index = Index;
+            UI_End(&Ctx);
+        }
+        printf("order: %5d windows, UI_OrderCommandRefs %.1f us, %.1f ns/block\n",
+               Counts[i], Best, Best * 1e3 / Counts[i]);
+        UI_Release(&Ctx);
+    }
+}
+
+/* The labels of a typical window, every fourth widget also hashes two
+ * sub-IDs like the buttons of a number widget */
+static char *Labels[] = {"Click me", "button 1", "button 2", "button 3", "Value0", "Value1", "Dropdown",
+    "CheckBox", "Apply changes", "Enable vertical sync", "Shadow map resolution", "OK", "Cancel",
+    "Texture filtering mode", "Field of view", "Mouse sensitivity"};
+#define LABEL_COUNT (int)(sizeof(Labels) / sizeof(Labels[0]))
+
+volatile ui_id Sink;
+
+void
+BenchHash(void) {
+    char *volatile *Names = Labels;
+    volatile ui_id Window = UI_HashString("Debug Window");
+    int Reps = 1000000;
+
+    double Best = 1e30;
+    for(int Run = 0; Run < 3; Run++) {
+        double Start = Now();
+        for(int r = 0; r < Reps; r++) {
+            ui_id Sum = 0;
+            for(int i = 0; i < LABEL_COUNT; i++) {
+                ui_id ID = UI_Hash(Names[i], Window);
+                Sum ^= ID;
+                if(i % 4 == 0) {
+                    Sum ^= UI_Hash("inc_button", ID) ^ UI_Hash("dec_button", ID);
+                }
+            }
+            Sink = Sum;
+        }
+        Best = MIN(Best, Now() - Start);
+    }
+    printf("hash: UI_Hash of the label, %.2f ns/widget\n", Best * 1e3 / ((double)Reps * LABEL_COUNT));
+
+#define WIDGET(S) { ui_id ID = UI_HashCombine(Window, UI_ID(S)); Sum ^= ID; }
+#define WIDGET_WITH_BUTTONS(S) { ui_id ID = UI_HashCombine(Window, UI_ID(S)); \
+    Sum ^= ID ^ UI_HashCombine(ID, UI_ID("inc_button")) ^ UI_HashCombine(ID, UI_ID("dec_button")); }
+    Best = 1e30;
+    for(int Run = 0; Run < 3; Run++) {
+        double Start = Now();
+        for(int r = 0; r < Reps; r++) {
+            ui_id Sum = 0;
+            WIDGET_WITH_BUTTONS("Click me") WIDGET("button 1") WIDGET("button 2") WIDGET("button 3")
+            WIDGET_WITH_BUTTONS("Value0") WIDGET("Value1") WIDGET("Dropdown") WIDGET("CheckBox")
+            WIDGET_WITH_BUTTONS("Apply changes") WIDGET("Enable vertical sync")
+            WIDGET("Shadow map resolution") WIDGET("OK") WIDGET_WITH_BUTTONS("Cancel")
+            WIDGET("Texture filtering mode") WIDGET("Field of view") WIDGET("Mouse sensitivity")
+            Sink = Sum;
+        }
+        Best = MIN(Best, Now() - Start);
+    }
+    printf("hash: UI_ID and UI_HashCombine, %.2f ns/widget\n", Best * 1e3 / ((double)Reps * LABEL_COUNT));
+#undef WIDGET
+#undef WIDGET_WITH_BUTTONS
+
+    static char *Lengths[] = {"ab", "abcdefgh", "Enable vertical sync.", "Texture filtering mode of the shadows"};
+    for(int i = 0; i < 4; i++) {
+        char *volatile Name = Lengths[i];
+        Best = 1e30;
+        for(int Run = 0; Run < 3; Run++) {
+            double Start = Now();
+            for(int r = 0; r < Reps * 4; r++) {
+                Sink = UI_Hash(Name, r);
+            }
+            Best = MIN(Best, Now() - Start);
+        }
+        printf("hash: UI_Hash of %2d chars, %.1f ns\n", (int)strlen(Lengths[i]), Best * 1e3 / (Reps * 4.0));
+    }
+}
+
+/* 5000 widgets of 90x20 in rows of 20 in one window, the mouse moves every
+ * frame. Input only calls UI_UpdateInputState for the rects of the buttons. */
+static char ButtonLabels[5000][16];
+static int DrawButtons;
+
+void
+HoverFrame(ui_context *Ctx) {
+    UI_Begin(Ctx);
+    if(UI_Window(Ctx, "grid", 0, 5600)) {
+        if(DrawButtons) {
+            UI_Inline(Ctx);
+        }
+        for(int i = 0; i < 5000; i++) {
+            if(DrawButtons) {
+                if(i % 20 == 0) {
+                    UI_Inline(Ctx);
+                    UI_Inline(Ctx);
+                }
+                UI_Button(Ctx, ButtonLabels[i]);
+            } else {
+                ui_rect Rect = UI_Rect(5 + (i % 20) * 95, 5500 - (i / 20) * 21, 90, 20);
+                UI_UpdateInputState(Ctx, Rect, 0x1000 + i);
+            }
+        }
+        if(DrawButtons) {
+            UI_Inline(Ctx);
+        }
+    }
+    UI_EndWindow(Ctx);
+    UI_End(Ctx);
+}
+
+void
+BenchHover(void) {
+    static ui_context Ctx;
+    for(int i = 0; i < 5000; i++) {
+        sprintf(ButtonLabels[i], "b%d", i);
+    }
+    for(DrawButtons = 0; DrawButtons < 2; DrawButtons++) {
+        InitContext(&Ctx, UI_Rect(0, 0, 2000, 5600));
+        HoverFrame(&Ctx);
+        PlaceWindow(&Ctx, "grid", UI_Rect(0, 0, 2000, 5600));
+        for(int f = 0; f < 3; f++) {
+            HoverFrame(&Ctx);
+        }
+        double Best = 1e30;
+        int HotFrames = 0;
+        for(int f = 0; f < 4000; f++) {
+            UI_MousePosition(&Ctx, 50 + (f * 37) % 1900, 50 + (f * 53) % 5400);
+            double Start = Now();
+            HoverFrame(&Ctx);
+            Best = MIN(Best, Now() - Start);
+            HotFrames += (Ctx.Hot != 0);
+        }
+        printf("hover: 5000 %s, mouse moving, %.1f us/frame (hot in %d of 4000 frames)\n",
+               DrawButtons ? "buttons" : "input-only widgets", Best, HotFrames);
+        UI_Release(&Ctx);
+    }
+}
+
+/* 50 columns of fixed, auto and fractional widths by 200 rows of text and
+ * check boxes, laid out with UI_Columns or the same widgets with UI_Inline */
+#define COLUMNS 50
+#define ROWS 200
+static ui_column Specs[COLUMNS];
+static char Cells[ROWS][COLUMNS][8];
+static int Checks[ROWS][COLUMNS];
+static int UseColumns;
+
+void
+ColumnsFrame(ui_context *Ctx) {
+    UI_Begin(Ctx);
+    if(UI_Window(Ctx, "table", 0, 900)) {
+        if(UseColumns) {
+            UI_Columns(Ctx, COLUMNS, Specs);
+        }
+        for(int r = 0; r < ROWS; r++) {
+            if(!UseColumns) {
+                UI_Inline(Ctx);
+            }
+            for(int c = 0; c < COLUMNS; c++) {
+                if(c % 5 == 4) {
+                    UI_CheckBoxID(Ctx, r * COLUMNS + c + 1, Cells[r][c], 0, &Checks[r][c]);
+                } else {
+                    UI_Text(Ctx, Cells[r][c], UI_Color(c, r, 0, 0));
+                }
+            }
+            if(!UseColumns) {
+                UI_Inline(Ctx);
+            }
+        }
+        if(UseColumns) {
+            UI_EndColumns(Ctx);
+        }
+    }
+    UI_EndWindow(Ctx);
+    UI_End(Ctx);
+}
+
+void
+BenchColumns(void) {
+    static ui_context Ctx;
+    for(int c = 0; c < COLUMNS; c++) {
+        Specs[c].Type = (c % 3 == 0) ? UI_COLUMN_FIXED : (c % 3 == 1) ? UI_COLUMN_AUTO : UI_COLUMN_FRACTION;
+        Specs[c].Size = (Specs[c].Type == UI_COLUMN_FIXED) ? 30 : 1 + c % 2;
+    }
+    srand(1);
+    for(int r = 0; r < ROWS; r++) {
+        for(int c = 0; c < COLUMNS; c++) {
+            int Length = 1 + rand() % 6;
+            for(int i = 0; i < Length; i++) {
+                Cells[r][c][i] = 'a' + rand() % 26;
+            }
+            Cells[r][c][Length] = 0;
+        }
+    }
+    for(int AllVisible = 0; AllVisible < 2; AllVisible++) {
+        for(UseColumns = 1; UseColumns >= 0; UseColumns--) {
+            int Height = AllVisible ? 4300 : 800;
+            InitContext(&Ctx, UI_Rect(0, 0, 4000, Height + 100));
+            UI_MousePosition(&Ctx, 3900, 10);
+            ColumnsFrame(&Ctx);
+            PlaceWindow(&Ctx, "table", UI_Rect(0, 100, 3600, Height));
+            for(int f = 0; f < 10; f++) {
+                ColumnsFrame(&Ctx);
+            }
+            double Best = 1e30;
+            for(int f = 0; f < 300; f++) {
+                double Start = Now();
+                ColumnsFrame(&Ctx);
+                Best = MIN(Best, Now() - Start);
+            }
+            printf("columns: %s, %s, %.1f us/frame\n", AllVisible ? "all rows visible" : "780 px visible",
+                   UseColumns ? "UI_Columns" : "UI_Inline", Best);
+            UI_Release(&Ctx);
+        }
+    }
+}
+
+/* The widgets of the demo's debug window followed by Extra more buttons,
+ * check boxes and text, in a window that shows all of them */
+static char GroupLabels[2000][16];
+static int GroupChecks[2000];
+
+void
+GroupFrame(ui_context *Ctx, int Extra) {
+    static char *Items[] = {"Alien", "Blade Runner", "Brazil", "Solaris"};
+    static float Value0, Value1;
+    static int Index, Check;
+    UI_Begin(Ctx);
+    if(UI_Window(Ctx, "group", 0, 0)) {
+        UI_Text(Ctx, "Frame time: 16.6 ms", UI_Color(255, 255, 255, 255));
+        UI_Text(Ctx, "Hot: 0 Active: 0", UI_Color(255, 255, 255, 255));
+        UI_Inline(Ctx);
+        UI_Button(Ctx, "Click me");
+        UI_Text(Ctx, "blabla", UI_Color(255, 255, 255, 255));
+        UI_Inline(Ctx);
+        UI_Number(Ctx, "Value1", 1, &Value1);
+        UI_Slider(Ctx, "Value0", 123, -10, &Value0);
+        UI_Dropdown(Ctx, "Dropdown", Items, 4, sizeof(char *), &Index);
+        UI_Inline(Ctx);
+        UI_Button(Ctx, "button 1");
+        UI_Button(Ctx, "button 2");
+        UI_Inline(Ctx);
+        UI_Button(Ctx, "button 3");
+        UI_CheckBox(Ctx, "CheckBox", 1, &Check);
+        for(int i = 0; i < Extra; i++) {
+            switch(i % 3) {
+                case 0: UI_Button(Ctx, GroupLabels[i]); break;
+                case 1: UI_CheckBoxID(Ctx, i + 1, GroupLabels[i], 1, &GroupChecks[i]); break;
+                case 2: UI_Text(Ctx, GroupLabels[i], UI_Color(200, 200, 200, 255)); break;
+            }
+        }
+    }
+    UI_EndWindow(Ctx);
+    UI_End(Ctx);
+}
+
+/* Batches are the runs of rects or of text and icons, a clip command ends
+ * a run. A backend that draws text from an atlas switches state between
+ * batches. */
+int
+CountBatches(ui_context *Ctx, int *CommandCount) {
+    int Batches = 0;
+    *CommandCount = 0;
+    ui_command_block *Block;
+    Ctx->BlockRefIndex = 0;
+    while(UI_NextBlock(Ctx, &Block)) {
+        int Kind = -1;
+        for(ui_command *Cmd = UI_BLOCK_BEGIN(Block); Cmd < UI_BLOCK_END(Block); Cmd = UI_NEXT_COMMAND(Cmd)) {
+            int CmdKind = (Cmd->Type == UI_COMMAND_RECT) ? 0 :
+                          (Cmd->Type == UI_COMMAND_TEXT || Cmd->Type == UI_COMMAND_ICON) ? 1 : -1;
+            Batches += (CmdKind >= 0 && CmdKind != Kind);
+            Kind = CmdKind;
+            (*CommandCount)++;
+        }
+    }
+    return Batches;
+}
+
+void
+BenchGroup(void) {
+    static ui_context Ctx;
+    static int Extras[] = {0, 2000};
+    for(int i = 0; i < 2000; i++) {
+        sprintf(GroupLabels[i], "widget %d", i);
+    }
+    for(int e = 0; e < 2; e++) {
+        int Height = Extras[e] * 24 + 400;
+        for(int ResolveClip = 0; ResolveClip < 2; ResolveClip++) {
+            int Batches[2], Commands[2];
+            double Times[2];
+            for(int Group = 0; Group < 2; Group++) {
+                InitContext(&Ctx, UI_Rect(0, 0, 700, Height + 20));
+                Ctx.ResolveClip = ResolveClip;
+                Ctx.GroupCommands = Group;
+                GroupFrame(&Ctx, Extras[e]);
+                PlaceWindow(&Ctx, "group", UI_Rect(10, 10, 600, Height));
+                GroupFrame(&Ctx, Extras[e]);
+                Batches[Group] = CountBatches(&Ctx, &Commands[Group]);
+                Times[Group] = 1e30;
+                for(int f = 0; f < 50; f++) {
+                    double Start = Now();
+                    GroupFrame(&Ctx, Extras[e]);
+                    Times[Group] = MIN(Times[Group], Now() - Start);
+                }
+                UI_Release(&Ctx);
+            }
+            printf("group: %s, %s clips, %d -> %d batches, %d -> %d commands, %.1f -> %.1f us/frame\n",
+                   Extras[e] ? "2k widgets" : "demo window", ResolveClip ? "resolved" : "stack",
+                   Batches[0], Batches[1], Commands[0], Commands[1], Times[0], Times[1]);
+        }
+    }
+}
+
+/* 1000 widgets ask for state in an open window, a tenth of them with a new
+ * ID every frame like the rows of a list that is scrolled. Only the states
+ * asked for in a frame are kept. */
+void
+StatesFrame(ui_context *Ctx, int Frame) {
+    UI_Begin(Ctx);
+    if(UI_Window(Ctx, "states", 0, 600)) {
+        for(int i = 0; i < 1000; i++) {
+            ui_id ID = (i % 10 == 0) ? 0x100000 + Frame * 100 + i / 10 : 0x1000 + i;
+            ++*(int *)UI_GetState(Ctx, ID, sizeof(int));
+        }
+    }
+    UI_EndWindow(Ctx);
+    UI_End(Ctx);
+}
+
+void
+BenchStates(void) {
+    static ui_context Ctx;
+    InitContext(&Ctx, UI_Rect(0, 0, 800, 600));
+    double Best = 1e30;
+    unsigned int MaxCount = 0;
+    for(int f = 0; f < 10000; f++) {
+        double Start = Now();
+        StatesFrame(&Ctx, f);
+        Best = MIN(Best, Now() - Start);
+        MaxCount = (Ctx.States.Count > MaxCount) ? Ctx.States.Count : MaxCount;
+        if(f == 9 || f == 999 || f == 9999) {
+            printf("states: 1000 widgets, 100 new IDs a frame, after %5d frames %u states (most %u), %u slots, %.1f us/frame\n",
+                   f + 1, Ctx.States.Count, MaxCount, Ctx.States.Capacity, Best);
+        }
+    }
+    UI_Release(&Ctx);
+}
+
+typedef struct {
+    char *Name;
+    void (* Run)(void);
+} benchmark;
+
+static benchmark Benchmarks[] = {
+    {"commands", BenchCommands},
+    {"order", BenchOrder},
+    {"hash", BenchHash},
+    {"hover", BenchHover},
+    {"columns", BenchColumns},
+    {"group", BenchGroup},
+    {"states", BenchStates},
+};
+
+int
+main(int ArgCount, char **Args) {
+    int Count = (int)(sizeof(Benchmarks) / sizeof(Benchmarks[0]));
+    for(int i = 0; i < Count; i++) {
+        int Selected = (ArgCount == 1);
+        for(int j = 1; j < ArgCount; j++) {
+            Selected |= !strcmp(Args[j], Benchmarks[i].Name);
+        }
+        if(Selected) {
+            Benchmarks[i].Run();
+        }
+    }
+    return 0;
+}
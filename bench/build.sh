@@ -0,0 +1,3 @@
+mkdir -p build
+CFLAGS="-Wall -std=c99 -pedantic -O2 -g -Werror"
+gcc $CFLAGS bench.c ../src/ui.c -I../src -o build/bench.bin
@@ -1,4 +1,4 @@
 (cd ../src/; ./build.sh)
 mkdir -p build
 CFLAGS="-Wall -std=c11 -pedantic -lSDL2 -lGL -O3 -g -Werror=implicit-function-declaration"
-gcc $CFLAGS demo.c ../src/ui.o -I../src -o build/demo.bin
+gcc $CFLAGS demo.c ../src/ui.o ../src/ui_drawlist.o ../src/ui_glyphcache.o -I../src -o build/demo.bin
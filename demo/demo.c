@@ -1,8 +1,10 @@
 #include <SDL2/SDL.h>
 #include <GL/gl.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "ui.h"
+#include "ui_drawlist.h"
 
 typedef uint8_t u8; 
 typedef uint16_t u16;
@@ -27,98 +29,9 @@ typedef double f64;
 
 #include "font/Atlas.inl"
 
-#define BUF_SIZE 1024
-
-f32 TexCoordBuf[BUF_SIZE * 8];
-f32 VertBuf[BUF_SIZE * 8];
-ui_color ColorBuf[BUF_SIZE * 4];
-u32 IndexBuf[BUF_SIZE * 6];
-u32 BufIndex;
-
-// ClipRects[0] is used for window clip rect
-STACK(ClipRects, 32, ui_rect);
-
 s32 WindowWidth = 640;
 s32 WindowHeight = 480;
 
-
-ui_rect
-Inside(ui_rect Rect, ui_rect Parent) {
-    s32 RMaxX = MIN(Rect.x + Rect.w, Parent.x + Parent.w);
-    s32 RMaxY = MIN(Rect.y + Rect.h, Parent.y + Parent.h);
-    Rect.x = MAX(Rect.x, Parent.x);
-    Rect.y = MAX(Rect.y, Parent.y);
-    Rect.w = MAX(0, RMaxX - Rect.x);
-    Rect.h = MAX(0, RMaxY - Rect.y);
-
-    return Rect;
-}
-
-void
-PushClipRect(ui_rect Rect) {
-    ASSERT(ClipRectsIndex + 1 < ARRAYCOUNT(ClipRects));
-    Rect = Inside(Rect, ClipRects[ClipRectsIndex - 1]);
-    ClipRects[ClipRectsIndex++] = Rect;
-}
-
-void
-PopClipRect() {
-    // Don't pop the window clip rect.
-    ASSERT(ClipRectsIndex > 1);
-    ClipRectsIndex--;
-}
-
-void
-PushRect(ui_rect Dest, ui_rect Src, ui_color Color) {
-    ASSERT(BufIndex < BUF_SIZE);
-
-    Dest = Inside(Dest, ClipRects[ClipRectsIndex - 1]);
-    if(Dest.w == 0 ||  Dest.h == 0) {
-        return;
-    }
-
-    u32 VertIndex = BufIndex * 8;
-    u32 ColorIndex = BufIndex * 4;
-    u32 ElementIndex = BufIndex * 4;
-    u32 Idx = BufIndex * 6;
-    BufIndex++;
-
-    // {1, 1}, {0, 1}, {1, 0}, {0, 0}
-    VertBuf[VertIndex] = Dest.x + Dest.w;
-    VertBuf[VertIndex + 1] = Dest.y + Dest.h;
-    VertBuf[VertIndex + 2] = Dest.x;
-    VertBuf[VertIndex + 3] = Dest.y + Dest.h;
-    VertBuf[VertIndex + 4] = Dest.x + Dest.w;
-    VertBuf[VertIndex + 5] = Dest.y;
-    VertBuf[VertIndex + 6] = Dest.x;
-    VertBuf[VertIndex + 7] = Dest.y;
-
-    f32 x = (f32)Src.x / ATLAS_WIDTH;
-    f32 y = (f32)Src.y / ATLAS_HEIGHT;
-    f32 w = (f32)Src.w / ATLAS_WIDTH;
-    f32 h = (f32)Src.h / ATLAS_HEIGHT;
-    TexCoordBuf[VertIndex] = x + w;
-    TexCoordBuf[VertIndex + 1] = y + h;
-    TexCoordBuf[VertIndex + 2] = x;
-    TexCoordBuf[VertIndex + 3] = y + h;
-    TexCoordBuf[VertIndex + 4] = x + w;
-    TexCoordBuf[VertIndex + 5] = y;
-    TexCoordBuf[VertIndex + 6] = x;
-    TexCoordBuf[VertIndex + 7] = y;
-
-    ColorBuf[ColorIndex] = Color;
-    ColorBuf[ColorIndex + 1] = Color;
-    ColorBuf[ColorIndex + 2] = Color;
-    ColorBuf[ColorIndex + 3] = Color;
-
-    IndexBuf[Idx] = ElementIndex;
-    IndexBuf[Idx + 1] = ElementIndex + 1;
-    IndexBuf[Idx + 2] = ElementIndex + 2;
-    IndexBuf[Idx + 3] = ElementIndex + 1;
-    IndexBuf[Idx + 4] = ElementIndex + 3;
-    IndexBuf[Idx + 5] = ElementIndex + 2;
-}
-
 u32
 AtlasIndex(char C) {
     u32 Index = (C - ' ' + ATLAS_FONT);
@@ -130,40 +43,61 @@ TextHeight() {
     return 16;
 }
 
+ui_glyph_cache GlyphCache;
+
+/* The atlas only has ASCII, other characters are drawn as a box */
+s32
+GlyphSize(void *User, u32 Codepoint, ui_glyph_metrics *Metrics) {
+    if(Codepoint == ' ') {
+        Metrics->Advance = 5;
+        return 1;
+    }
+    if(Codepoint < ' ' || Codepoint == 127) {
+        return 0;
+    }
+    if(Codepoint < 128) {
+        Metrics->Width = Atlas[AtlasIndex(Codepoint)].w;
+        Metrics->Height = TextHeight();
+    } else {
+        Metrics->Width = 7;
+        Metrics->Height = 10;
+        Metrics->OffsetY = 3;
+    }
+    Metrics->Advance = Metrics->Width + 1;
+    return 1;
+}
+
 void
-DrawText(s32 x, s32 y, ui_color Color, char *Str) {
-    s32 CursorX = x;
-    for(char *C = Str; *C; C++) {
-        if(*C == ' ') {
-            CursorX += 5;
-            continue;
+RasterizeGlyph(void *User, u32 Codepoint, u8 *Pixels, s32 Stride) {
+    if(Codepoint < 128) {
+        ui_rect Src = Atlas[AtlasIndex(Codepoint)];
+        for(s32 y = 0; y < TextHeight(); y++) {
+            memcpy(Pixels + y * Stride, AtlasTexture + (Src.y + y) * ATLAS_WIDTH + Src.x, Src.w);
+        }
+    } else {
+        for(s32 y = 0; y < 10; y++) {
+            for(s32 x = 0; x < 7; x++) {
+                Pixels[y * Stride + x] = (x == 0 || x == 6 || y == 0 || y == 9) ? 255 : 0;
+            }
         }
-        ui_rect Src = Atlas[AtlasIndex(*C)];
-        Src.h = TextHeight();
-        ui_rect Dest = {CursorX, y, Src.w, Src.h};
-        PushRect(Dest, Src, Color);
-        CursorX += Src.w + 1;
     }
 }
 
 s32
-TextWidth(char *Str) {
-    s32 Result = 0;
-    for(char *C = Str; *C; C++) {
-        if(*C == ' ') {
-            Result += 5;
-            continue;
-        }
-        Result += Atlas[AtlasIndex(*C)].w + 1;
-    }
-    return Result;
+MeasureText(char *Text, s32 Length) {
+    return UI_MeasureGlyphs(&GlyphCache, Text, Length);
 }
 
-void
-DrawTextCentered(ui_rect Rect, ui_color Color, char *Str) {
-    s32 x = Rect.x + (Rect.w - TextWidth(Str)) / 2;
-    s32 y = Rect.y + (Rect.h - TextHeight()) / 2;
-    DrawText(x, y, Color, Str);
+/* Copies a rect of the fixed atlas to a rect of the glyph cache that's never evicted */
+ui_rect
+ReserveAtlasRect(ui_rect Src) {
+    ui_rect Rect;
+    ASSERT(UI_ReserveGlyphRect(&GlyphCache, Src.w, Src.h, &Rect));
+    for(s32 y = 0; y < Src.h; y++) {
+        memcpy(GlyphCache.Pixels + (Rect.y + y) * GlyphCache.AtlasWidth + Rect.x,
+               AtlasTexture + (Src.y + y) * ATLAS_WIDTH + Src.x, Src.w);
+    }
+    return Rect;
 }
 
 typedef struct {
@@ -192,16 +126,46 @@ main() {
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
     glEnableClientState(GL_COLOR_ARRAY);
 
+    GlyphCache.AtlasWidth = 256;
+    GlyphCache.AtlasHeight = 256;
+    GlyphCache.GlyphSize = GlyphSize;
+    GlyphCache.Rasterize = RasterizeGlyph;
+
+    ui_draw_metrics Metrics = {0};
+    Metrics.AtlasWidth = GlyphCache.AtlasWidth;
+    Metrics.AtlasHeight = GlyphCache.AtlasHeight;
+    Metrics.White = ReserveAtlasRect(Atlas[ATLAS_WHITE]);
+    Metrics.Icons[UI_ICON_COLLAPSE] = ReserveAtlasRect(Atlas[ATLAS_COLLAPSE]);
+    Metrics.Icons[UI_ICON_RESIZE] = ReserveAtlasRect(Atlas[ATLAS_RESIZE]);
+    Metrics.Icons[UI_ICON_EXPAND] = ReserveAtlasRect(Atlas[ATLAS_EXPAND]);
+    Metrics.GlyphCache = &GlyphCache;
+    ui_drawlist DrawList = {0};
+
+    /* Glyphs are uploaded as they're added, see the dirty rects after UI_BuildDrawList */
     GLuint TextureID;
     glGenTextures(1, &TextureID);
     glBindTexture(GL_TEXTURE_2D, TextureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, ATLAS_WIDTH, ATLAS_HEIGHT, 0, GL_ALPHA, GL_UNSIGNED_BYTE, AtlasTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, GlyphCache.AtlasWidth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, GlyphCache.AtlasWidth, GlyphCache.AtlasHeight, 0, GL_ALPHA, GL_UNSIGNED_BYTE, GlyphCache.Pixels);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
+    /* ASCII is measured from the advances, the rest by the glyph cache */
+    s32 Advance[128];
+    for(u32 C = 0; C < 128; C++) {
+        ui_glyph_metrics GlyphMetrics = {0};
+        if(!GlyphSize(0, C, &GlyphMetrics)) {
+            GlyphSize(0, '?', &GlyphMetrics);
+        }
+        Advance[C] = GlyphMetrics.Advance;
+    }
+
     ui_context UIContext = {0};
     UIContext.TextHeight = TextHeight();
-    UIContext.TextWidth = TextWidth;
+    UIContext.MeasureText = MeasureText;
+    UI_SetGlyphAdvances(&UIContext, Advance);
+    UIContext.ResolveClip = 1;
 
     while(1) {
         SDL_Event Event;
@@ -254,8 +218,7 @@ main() {
 
         glViewport(0, 0, WindowWidth, WindowHeight);
         glScissor(0, 0, WindowWidth, WindowHeight);
-        ClipRects[0] = UI_Rect(0, 0, WindowWidth, WindowHeight);
-        ClipRectsIndex = 1;
+        UIContext.Viewport = UI_Rect(0, 0, WindowWidth, WindowHeight);
         glMatrixMode(GL_PROJECTION);
         glPushMatrix();
         glLoadIdentity();
@@ -268,72 +231,75 @@ main() {
         glClear(GL_COLOR_BUFFER_BIT);
 
         ui_color White = {255, 255, 255, 255};
+        static char ActiveAndHotIDs[128]; 
 
         UI_Begin(&UIContext);
 
-        UI_Window(&UIContext, "Debug Window", 10, WindowHeight);
-        ui_window *UIWindow = UI_FindWindow(&UIContext, UI_Hash("Debug Window", 0));
-        char Buf[128]; sprintf(Buf, "z-index %d", UIWindow->ZIndex);
-        UI_Text(&UIContext, Buf, White);
-
-        {
-            static char Buf[128]; sprintf(Buf, "Mouse Pos: (%d, %d)", UIContext.MousePos.x, UIContext.MousePos.y);
+        // The widgets are only built if the window is visible
+        if(UI_Window(&UIContext, "Debug Window", 10, WindowHeight)) {
+            ui_window *UIWindow = UI_FindWindow(&UIContext, UI_ID("Debug Window"));
+            char Buf[128]; sprintf(Buf, "z-index %d", UIWindow->ZIndex);
             UI_Text(&UIContext, Buf, White);
-        }
-        {
-            static char Buf[128]; sprintf(Buf, "This window's ID: 0x%x", UI_FindWindow(&UIContext, UI_Hash("Debug Window", 0))->ID);
-            UI_Text(&UIContext, Buf, White);
-        }
 
-        static char ActiveAndHotIDs[128]; 
-        UI_Text(&UIContext, ActiveAndHotIDs, White);
+            {
+                static char Buf[128]; sprintf(Buf, "Mouse Pos: (%d, %d)", UIContext.MousePos.x, UIContext.MousePos.y);
+                UI_Text(&UIContext, Buf, White);
+            }
+            {
+                static char Buf[128]; sprintf(Buf, "This window's ID: 0x%x", UI_FindWindow(&UIContext, UI_ID("Debug Window"))->ID);
+                UI_Text(&UIContext, Buf, White);
+            }
 
-        UI_Inline(&UIContext);
-        static int V;
-        if(UI_Button(&UIContext, "Click me") == UI_INTERACTION_PRESS_AND_RELEASED) {
-            V++;
-        }
+            UI_Text(&UIContext, ActiveAndHotIDs, White);
+            UI_Text(&UIContext, "UTF-8: Gr\xc3\xbc\xc3\x9f" "e, na\xc3\xafve caf\xc3\xa9", White);
 
-        char blabla[128];
-        sprintf(blabla, "%d", V);
-        UI_Text(&UIContext, blabla, White);
-        UI_Inline(&UIContext);
-
-        static float Value0, Value1;
-        UI_Number(&UIContext, "Value1", 1, &Value1);
-        UI_Slider(&UIContext, "Value0", 123, -10, &Value0);
-        Value0 = (int)Value0;
-
-        movie Movies[] = {
-            {"Kill Bill", 150},
-            {"2001: A Space Oddysey", 150},
-            {"Sunset Limited", 150},
-            {"Micmacs", 150},
-            {"Requiem for a Dream", 150},
-            {"Do the right thing", 150},
-            {"The Drop", 150},
-            {"Glengarry Glen Ross", 150},
-            {"Star Wars: Return of the Jedi", 150},
-            {"Scream", 150},
-            {"Napoleon Dynamite", 150},
-            {"Black Dynamite", 150}
-        };
-
-        static int Index;
-        if(UI_Dropdown(&UIContext, "Dropdown", &(Movies[0].Title), ARRAYCOUNT(Movies), (char*)&Movies[1].Title - (char*)&Movies[0].Title, &Index)) {
-            printf("%s\n", Movies[Index].Title);
-        }
+            UI_Inline(&UIContext);
+            static int V;
+            if(UI_ButtonID(&UIContext, UI_ID("Click me"), "Click me") == UI_INTERACTION_PRESS_AND_RELEASED) {
+                V++;
+            }
+
+            char blabla[128];
+            sprintf(blabla, "%d", V);
+            UI_Text(&UIContext, blabla, White);
+            UI_Inline(&UIContext);
+
+            static float Value0, Value1;
+            UI_Number(&UIContext, "Value1", 1, &Value1);
+            UI_Slider(&UIContext, "Value0", 123, -10, &Value0);
+            Value0 = (int)Value0;
+
+            movie Movies[] = {
+                {"Kill Bill", 150},
+                {"2001: A Space Oddysey", 150},
+                {"Sunset Limited", 150},
+                {"Micmacs", 150},
+                {"Requiem for a Dream", 150},
+                {"Do the right thing", 150},
+                {"The Drop", 150},
+                {"Glengarry Glen Ross", 150},
+                {"Star Wars: Return of the Jedi", 150},
+                {"Scream", 150},
+                {"Napoleon Dynamite", 150},
+                {"Black Dynamite", 150}
+            };
+
+            static int Index;
+            if(UI_Dropdown(&UIContext, "Dropdown", &(Movies[0].Title), ARRAYCOUNT(Movies), (char*)&Movies[1].Title - (char*)&Movies[0].Title, &Index)) {
+                printf("%s\n", Movies[Index].Title);
+            }
 
 
-        UI_Inline(&UIContext);
-        UI_Button(&UIContext, "button 1");
-        UI_Button(&UIContext, "button 2");
-        UI_Inline(&UIContext);
+            UI_Inline(&UIContext);
+            UI_Button(&UIContext, "button 1");
+            UI_Button(&UIContext, "button 2");
+            UI_Inline(&UIContext);
 
-        UI_Button(&UIContext, "button 3");
+            UI_Button(&UIContext, "button 3");
 
-        static int Boolean = 1;
-        UI_CheckBox(&UIContext, "CheckBox", 1, &Boolean);
+            static int Boolean = 1;
+            UI_CheckBox(&UIContext, "CheckBox", 1, &Boolean);
+        }
 
         UI_EndWindow(&UIContext);
 
@@ -341,40 +307,23 @@ main() {
 
         sprintf(ActiveAndHotIDs, "Hot: 0x%x, Active 0x%x, PopUp 0x%x", UIContext.Hot, UIContext.Active, UIContext.PopUp.ID);
 
-        ui_command *Cmd;
-        while(UI_NextCommand(&UIContext, &Cmd)) {
-            switch(Cmd->Type) {
-                case UI_COMMAND_RECT: {
-                    PushRect(Cmd->Command.Rect.Rect, Atlas[ATLAS_WHITE], Cmd->Command.Rect.Color);
-                } break;
-                case UI_COMMAND_TEXT: {
-                    DrawText(Cmd->Command.Text.Rect.x, Cmd->Command.Text.Rect.y, 
-                             Cmd->Command.Text.Color, Cmd->Command.Text.Text);
-                } break;
-                case UI_COMMAND_PUSH_CLIP: {
-                    PushClipRect(Cmd->Command.Clip.Rect);
-                } break;
-                case UI_COMMAND_POP_CLIP: {
-                    PopClipRect();
-                } break;
-                case UI_COMMAND_ICON: {
-                    int Icons[] = {
-                        [UI_ICON_COLLAPSE] = ATLAS_COLLAPSE,
-                        [UI_ICON_RESIZE] = ATLAS_RESIZE,
-                        [UI_ICON_EXPAND] = ATLAS_EXPAND};
-                    PushRect(Cmd->Command.Icon.Rect, Atlas[Icons[Cmd->Command.Icon.ID]], 
-                             Cmd->Command.Icon.Color);
-                } break;
-            }
+        UI_BuildDrawList(&UIContext, &DrawList, &Metrics);
+        for(s32 i = 0; i < GlyphCache.DirtyCount; i++) {
+            ui_rect Dirty = GlyphCache.Dirty[i];
+            glTexSubImage2D(GL_TEXTURE_2D, 0, Dirty.x, Dirty.y, Dirty.w, Dirty.h, GL_ALPHA, GL_UNSIGNED_BYTE,
+                            GlyphCache.Pixels + Dirty.y * GlyphCache.AtlasWidth + Dirty.x);
         }
 
-        glTexCoordPointer(2, GL_FLOAT, 0, TexCoordBuf);
-        glVertexPointer(2, GL_FLOAT, 0, VertBuf);
-        glColorPointer(4, GL_UNSIGNED_BYTE, 0, ColorBuf);
+        glVertexPointer(2, GL_FLOAT, sizeof(ui_vertex), &DrawList.Vertices[0].x);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(ui_vertex), &DrawList.Vertices[0].u);
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(ui_vertex), &DrawList.Vertices[0].Color);
+        for(u32 i = 0; i < DrawList.BatchCount; i++) {
+            ui_draw_batch *Batch = &DrawList.Batches[i];
+            glScissor(Batch->Clip.x, Batch->Clip.y, Batch->Clip.w, Batch->Clip.h);
+            glDrawElements(GL_TRIANGLES, Batch->IndexCount, GL_UNSIGNED_INT, 
+                           (const GLvoid *)(DrawList.Indices + Batch->IndexOffset));
+        }
         ASSERT(glGetError() == 0);
-        glDrawElements(GL_TRIANGLES, 6 * BufIndex, GL_UNSIGNED_INT, (const GLvoid *)IndexBuf);
-
-        BufIndex = 0;
 
         glMatrixMode(GL_MODELVIEW);
         glPopMatrix();
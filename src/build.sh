@@ -1,2 +1,4 @@
 CFLAGS="-Wall -std=c99 -pedantic -O0 -g -Werror"
 gcc $CFLAGS -c ui.c -o ui.o
+gcc $CFLAGS -c ui_drawlist.c -o ui_drawlist.o
+gcc $CFLAGS -c ui_glyphcache.c -o ui_glyphcache.o
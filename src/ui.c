@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ui.h"
 
 #define UI_OFFSET_OF(Type, Member) ((size_t) &(((Type *)0)->Member))
@@ -13,6 +14,9 @@
 #define UI_MAX(X, Y) ((X > Y) ? X : Y)
 #define UI_MIN(X, Y) ((X < Y) ? X : Y)
 #define UI_INT_MAX 0x7fffffff
+#define UI_UNBOUNDED_RECT UI_Rect(-UI_INT_MAX / 2, -UI_INT_MAX / 2, UI_INT_MAX, UI_INT_MAX)
+#define UI_CHUNK_DATA(Chunk) ((unsigned char *)((Chunk) + 1))
+#define UI_ZINDEX_RENORMALIZE (UI_INT_MAX / 2)
 
 ui_color UI_COLOR1 = {0x32, 0x30, 0x31, 0xff};
 ui_color UI_COLOR0 = {0x3d, 0x3b, 0x3c, 0xff};
@@ -24,15 +28,54 @@ ui_color UI_COLOR_HIGHLIGHT = {0x9e, 0xbb, 0x6b, 0xff};
 
 /* Util */
 
+#define UI_LOAD_WORD(At) ((At)[0] | (At)[1] << 8 | (At)[2] << 16 | (unsigned int)(At)[3] << 24)
+
+ui_str
+UI_Str(char *Data, int Length) {
+    ui_str Result;
+    Result.Data = Data;
+    Result.Length = Length;
+    return Result;
+}
+
+ui_str
+UI_CStr(char *Str) {
+    return UI_Str(Str, (int)strlen(Str));
+}
+
+/* Same hash as UI_ID, see ui.h. The words are independent of each other until
+ * they are summed so several of them are in flight at once. The last partial
+ * word is loaded together with the bytes before it and shifted down. */
 ui_id
-UI_Hash(char *Str, ui_id Hash) {
-    if(!Hash) {
-        Hash = 2166136261;
+UI_HashStr(ui_str Str) {
+    unsigned int Length = Str.Length;
+    unsigned char *At = (unsigned char *)Str.Data;
+    unsigned int Sum = 0;
+    unsigned int Index = 0;
+    for(; 4 * Index + 4 <= Length; Index++, At += 4) {
+        Sum += UI_HashWord(UI_LOAD_WORD(At), Index);
     }
-    while(*Str) {
-        Hash = (Hash ^ *Str++) * 16777619;
+    unsigned int Rest = Length & 3;
+    if(Rest) {
+        unsigned int Word;
+        if(Length >= 4) {
+            Word = UI_LOAD_WORD(At + Rest - 4) >> (8 * (4 - Rest));
+        } else {
+            Word = At[0] | (Rest > 1 ? At[1] << 8 : 0) | (Rest > 2 ? At[2] << 16 : 0);
+        }
+        Sum += UI_HashWord(Word, Index);
     }
-    return Hash;
+    return UI_HashFinalize(Sum, Length);
+}
+
+ui_id
+UI_HashString(char *Str) {
+    return UI_HashStr(UI_CStr(Str));
+}
+
+ui_id
+UI_Hash(char *Str, ui_id Hash) {
+    return UI_HashCombine(Hash, UI_HashString(Str));
 }
 
 float
@@ -86,60 +129,1277 @@ UI_Color(unsigned char r, unsigned char g, unsigned char b, unsigned char a) {
     return Result;
 }
 
+ui_rect
+UI_IntersectRect(ui_rect A, ui_rect B) {
+    int MaxX = UI_MIN(A.x + A.w, B.x + B.w);
+    int MaxY = UI_MIN(A.y + A.h, B.y + B.h);
+    ui_rect Result;
+    Result.x = UI_MAX(A.x, B.x);
+    Result.y = UI_MAX(A.y, B.y);
+    Result.w = UI_MAX(0, MaxX - Result.x);
+    Result.h = UI_MAX(0, MaxY - Result.y);
+    return Result;
+}
+
+int
+UI_RectEquals(ui_rect A, ui_rect B) {
+    return (A.x == B.x && A.y == B.y && A.w == B.w && A.h == B.h);
+}
+
+int
+UI_RectsOverlap(ui_rect A, ui_rect B) {
+    ui_rect Overlap = UI_IntersectRect(A, B);
+    return (Overlap.w > 0 && Overlap.h > 0);
+}
+
+int
+UI_RectContains(ui_rect Outer, ui_rect Inner) {
+    return (Inner.x >= Outer.x && Inner.y >= Outer.y &&
+            Inner.x + Inner.w <= Outer.x + Outer.w &&
+            Inner.y + Inner.h <= Outer.y + Outer.h);
+}
+
+int
+UI_PointInsideRect(ui_rect Rect, ui_v2 P) {
+    if((P.x >= Rect.x && P.x <= (Rect.x + Rect.w)) &&
+       (P.y >= Rect.y && P.y <= (Rect.y + Rect.h))) {
+       return 1;
+   }
+    return 0;  
+}
+
+/* Smallest rect containing both, empty rects are ignored */
+ui_rect
+UI_UnionRect(ui_rect A, ui_rect B) {
+    if(A.w <= 0 || A.h <= 0) {
+        return B;
+    }
+    if(B.w <= 0 || B.h <= 0) {
+        return A;
+    }
+    int MaxX = UI_MAX(A.x + A.w, B.x + B.w);
+    int MaxY = UI_MAX(A.y + A.h, B.y + B.h);
+    ui_rect Result;
+    Result.x = UI_MIN(A.x, B.x);
+    Result.y = UI_MIN(A.y, B.y);
+    Result.w = MaxX - Result.x;
+    Result.h = MaxY - Result.y;
+    return Result;
+}
+
 /* Begin/End */
 
+/* Memory */
+
+void *
+UI_Allocate(ui_context *Ctx, size_t Size) {
+    void *Result = 0;
+    if(!Ctx->MemoryBudget || Ctx->MemoryUsed + Size <= Ctx->MemoryBudget) {
+        Result = Ctx->Alloc ? Ctx->Alloc(Size) : malloc(Size);
+    }
+    /* Running out of memory is only recoverable in budget mode */
+    UI_ASSERT(Result || Ctx->MemoryBudget, "Out of memory");
+    if(Result) {
+        Ctx->MemoryUsed += Size;
+    }
+    return Result;
+}
+
+void
+UI_Deallocate(ui_context *Ctx, void *Memory, size_t Size) {
+    if(Ctx->Free) {
+        Ctx->Free(Memory);
+    } else {
+        free(Memory);
+    }
+    Ctx->MemoryUsed -= Size;
+}
+
+/* Windows and widget state can't be dropped like commands, so their memory
+ * is counted in MemoryUsed but never refused by MemoryBudget */
+void *
+UI_AllocateWindowMemory(ui_context *Ctx, size_t Size) {
+    void *Result = Ctx->Alloc ? Ctx->Alloc(Size) : malloc(Size);
+    UI_ASSERT(Result, "Out of memory");
+    memset(Result, 0, Size);
+    Ctx->MemoryUsed += Size;
+    return Result;
+}
+
+ui_memory_chunk *
+UI_AllocateChunk(ui_context *Ctx, ui_memory_chunk **List, size_t Size) {
+    ui_memory_chunk *Chunk = UI_Allocate(Ctx, sizeof(ui_memory_chunk) + Size);
+    if(Chunk) {
+        Chunk->Size = Size;
+        Chunk->Used = 0;
+        Chunk->Next = *List;
+        *List = Chunk;
+    }
+    return Chunk;
+}
+
+void
+UI_FreeChunks(ui_context *Ctx, ui_memory_chunk *Chunk) {
+    while(Chunk) {
+        ui_memory_chunk *Next = Chunk->Next;
+        UI_Deallocate(Ctx, Chunk, sizeof(ui_memory_chunk) + Chunk->Size);
+        Chunk = Next;
+    }
+}
+
+ui_command_ref *
+UI_PushCommandRef(ui_context *Ctx) {
+    if(Ctx->CommandRefStack.Index == Ctx->CommandRefStack.Capacity) {
+        unsigned int Capacity = UI_MAX(64, Ctx->CommandRefStack.Capacity * 2);
+        ui_command_ref *Items = UI_Allocate(Ctx, Capacity * sizeof(ui_command_ref));
+        if(!Items) {
+            return 0;
+        }
+        if(Ctx->CommandRefStack.Items) {
+            memcpy(Items, Ctx->CommandRefStack.Items, Ctx->CommandRefStack.Index * sizeof(ui_command_ref));
+            UI_Deallocate(Ctx, Ctx->CommandRefStack.Items, Ctx->CommandRefStack.Capacity * sizeof(ui_command_ref));
+        }
+        Ctx->CommandRefStack.Items = Items;
+        Ctx->CommandRefStack.Capacity = Capacity;
+    }
+    /* Every block can be in the heap of closed blocks, it never grows when
+     * a block is closed */
+    if(Ctx->MemoryBudget && Ctx->ClosedBlocks.Capacity < Ctx->CommandRefStack.Capacity) {
+        unsigned int Capacity = Ctx->CommandRefStack.Capacity;
+        int *Items = UI_Allocate(Ctx, Capacity * sizeof(int));
+        if(!Items) {
+            return 0;
+        }
+        if(Ctx->ClosedBlocks.Items) {
+            memcpy(Items, Ctx->ClosedBlocks.Items, Ctx->ClosedBlocks.Count * sizeof(int));
+            UI_Deallocate(Ctx, Ctx->ClosedBlocks.Items, Ctx->ClosedBlocks.Capacity * sizeof(int));
+        }
+        Ctx->ClosedBlocks.Items = Items;
+        Ctx->ClosedBlocks.Capacity = Capacity;
+    }
+    return &Ctx->CommandRefStack.Items[Ctx->CommandRefStack.Index++];
+}
+
 int
-UI_PartitionCommandRefs(ui_command_ref *CmdRefs, int Low, int High) {
-#define UI_SWAP(A, B) ui_command_ref T = A; A = B; B = T;
-    ui_command_ref Pivot = CmdRefs[High];
-    int i = Low;
-    for(int j = Low; j < High; j++) {
-        if(CmdRefs[j].SortKey < Pivot.SortKey) {
-            UI_SWAP(CmdRefs[i], CmdRefs[j]);
-            i++;
+UI_ClosedBlockZIndex(ui_context *Ctx, unsigned int i) {
+    return Ctx->CommandRefStack.Items[Ctx->ClosedBlocks.Items[i]].Target->ZIndex;
+}
+
+void
+UI_SwapClosedBlocks(ui_context *Ctx, unsigned int i, unsigned int j) {
+    int Ref = Ctx->ClosedBlocks.Items[i];
+    Ctx->ClosedBlocks.Items[i] = Ctx->ClosedBlocks.Items[j];
+    Ctx->ClosedBlocks.Items[j] = Ref;
+}
+
+void
+UI_PushClosedBlock(ui_context *Ctx, int Ref) {
+    unsigned int i = Ctx->ClosedBlocks.Count++;
+    Ctx->ClosedBlocks.Items[i] = Ref;
+    while(i > 0 && UI_ClosedBlockZIndex(Ctx, i) < UI_ClosedBlockZIndex(Ctx, (i - 1) / 2)) {
+        UI_SwapClosedBlocks(Ctx, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+void
+UI_PopClosedBlock(ui_context *Ctx) {
+    unsigned int Count = --Ctx->ClosedBlocks.Count;
+    Ctx->ClosedBlocks.Items[0] = Ctx->ClosedBlocks.Items[Count];
+    unsigned int i = 0;
+    for(;;) {
+        unsigned int Lowest = i;
+        for(unsigned int Child = 2 * i + 1; Child <= 2 * i + 2 && Child < Count; Child++) {
+            if(UI_ClosedBlockZIndex(Ctx, Child) < UI_ClosedBlockZIndex(Ctx, Lowest)) {
+                Lowest = Child;
+            }
+        }
+        if(Lowest == i) {
+            break;
         }
+        UI_SwapClosedBlocks(Ctx, i, Lowest);
+        i = Lowest;
     }
-    UI_SWAP(CmdRefs[i], CmdRefs[High]);
-#undef UI_SWAP
-    return i;
+}
+
+int
+UI_BlockIsOpen(ui_context *Ctx, ui_command_block *Block) {
+    return (Block == Ctx->ActiveBlock || Block == Ctx->PausedBlock);
+}
+
+/* Finds a chunk with at least Size bytes free that doesn't end with an open
+ * block. A new chunk is allocated if there's none. */
+ui_memory_chunk *
+UI_FindCommandChunk(ui_context *Ctx, size_t Size) {
+    for(ui_memory_chunk *Chunk = Ctx->CommandChunks; Chunk; Chunk = Chunk->Next) {
+        if((!Ctx->ActiveBlock || Chunk != Ctx->ActiveBlock->Chunk) &&
+           (!Ctx->PausedBlock || Chunk != Ctx->PausedBlock->Chunk) &&
+           Chunk->Size - Chunk->Used >= Size) {
+            return Chunk;
+        }
+    }
+    /* Twice the size so a block that keeps growing isn't moved on every push,
+     * if that's over budget try to fit just the requested size */
+    ui_memory_chunk *Result = UI_AllocateChunk(Ctx, &Ctx->CommandChunks, UI_MAX(UI_COMMAND_CHUNK_SIZE, 2 * Size));
+    if(!Result) {
+        Result = UI_AllocateChunk(Ctx, &Ctx->CommandChunks, Size);
+    }
+    return Result;
+}
+
+/* Moves the active block to a chunk with room for Size more bytes */
+int
+UI_RelocateActiveBlock(ui_context *Ctx, size_t Size) {
+    ui_command_block *Block = Ctx->ActiveBlock;
+    ui_memory_chunk *Chunk = UI_FindCommandChunk(Ctx, Block->Size + Size);
+    if(!Chunk) {
+        return 0;
+    }
+
+    ui_command_block *Dest = (ui_command_block *)(UI_CHUNK_DATA(Chunk) + Chunk->Used);
+    memcpy(Dest, Block, Block->Size);
+    Block->Chunk->Used -= Block->Size;
+    Chunk->Used += Block->Size;
+
+    Ctx->CommandRefStack.Items[Block->Ref].Target = Dest;
+    Dest->Chunk = Chunk;
+    Ctx->ActiveBlock = Dest;
+    return 1;
 }
 
 void
-UI_SortCommandRefs(ui_command_ref *CmdRefs, int Low, int High) {
-    if(Low < High) {
-        int P = UI_PartitionCommandRefs(CmdRefs, Low, High);
-        UI_SortCommandRefs(CmdRefs, Low, P - 1);
-        UI_SortCommandRefs(CmdRefs, P + 1, High);
+UI_RebaseBlock(ui_command_block **Block, unsigned char *Start, unsigned char *End, size_t Size) {
+    unsigned char *P = (unsigned char *)*Block;
+    if(P > Start && P < End) {
+        *Block = (ui_command_block *)(P - Size);
     }
 }
 
-ui_command *
-UI_PushCommandEx(ui_context *Ctx, int Direction) {
-    UI_ASSERT(Ctx->CommandStack.Index2 > (Ctx->CommandStack.Index + 1), "Command stack full");
-    ui_command *Result;
-    if(Direction == 1) {
-        Result = &Ctx->CommandStack.Items[Ctx->CommandStack.Index++];
-    } else if(Direction == -1) {
-        Result = &Ctx->CommandStack.Items[Ctx->CommandStack.Index2--];
+/* Frees the space of the closed block with the lowest z-index if it's lower
+ * than the z-index of the active block. Everything after the block in its 
+ * chunk is moved down to fill the space, only the references of the blocks
+ * that moved are updated. */
+int
+UI_EvictBlock(ui_context *Ctx) {
+    ui_command_ref *Refs = Ctx->CommandRefStack.Items;
+    if(!Ctx->ClosedBlocks.Count || UI_ClosedBlockZIndex(Ctx, 0) >= Ctx->ActiveBlock->ZIndex) {
+        return 0;
+    }
+    ui_command_block *Block = Refs[Ctx->ClosedBlocks.Items[0]].Target;
+    UI_PopClosedBlock(Ctx);
+    Refs[Block->Ref].Target = 0;
+
+    ui_memory_chunk *Chunk = Block->Chunk;
+    size_t Size = Block->Size;
+    unsigned char *Start = (unsigned char *)Block;
+    unsigned char *ChunkEnd = UI_CHUNK_DATA(Chunk) + Chunk->Used;
+    Ctx->DroppedBlockCount++;
+    Ctx->DroppedCommandCount += Block->CommandCount;
+    memmove(Start, Start + Size, ChunkEnd - (Start + Size));
+    Chunk->Used -= Size;
+
+    for(unsigned char *P = Start; P < ChunkEnd - Size; P += ((ui_command_block *)P)->Size) {
+        ui_command_block *Moved = (ui_command_block *)P;
+        Refs[Moved->Ref].Target = Moved;
+    }
+    if(Ctx->ActiveBlock) {
+        UI_RebaseBlock(&Ctx->ActiveBlock, Start, ChunkEnd, Size);
+    }
+    if(Ctx->PausedBlock) {
+        UI_RebaseBlock(&Ctx->PausedBlock, Start, ChunkEnd, Size);
+    }
+    return 1;
+}
+
+/* Makes the discarded block active, the commands pushed to it are dropped */
+void
+UI_InitBlock(ui_command_block *Block, ui_id ID, int ZIndex, ui_memory_chunk *Chunk) {
+    memset(Block, 0, sizeof(ui_command_block));
+    Block->Header.Type = UI_COMMAND_BLOCK;
+    Block->Header.Size = sizeof(ui_command_block);
+    Block->ID = ID;
+    Block->ZIndex = ZIndex;
+    Block->Size = sizeof(ui_command_block);
+    Block->Dropped = !Chunk;
+    Block->Chunk = Chunk;
+}
+
+void
+UI_DiscardBlock(ui_context *Ctx, ui_id ID, int ZIndex) {
+    UI_InitBlock(&Ctx->DiscardedBlock, ID, ZIndex, 0);
+    Ctx->ActiveBlock = &Ctx->DiscardedBlock;
+}
+
+/* Gives up the active block, the rest of its commands are discarded */
+void
+UI_DropActiveBlock(ui_context *Ctx) {
+    ui_command_block *Block = Ctx->ActiveBlock;
+    Ctx->CommandRefStack.Items[Block->Ref].Target = 0;
+    Block->Chunk->Used -= Block->Size;
+
+    Ctx->DroppedBlockCount++;
+    Ctx->DroppedCommandCount += Block->CommandCount;
+    UI_DiscardBlock(Ctx, Block->ID, Block->ZIndex);
+}
+
+/* Makes room for Size more bytes at the end of the active block. In budget 
+ * mode lower blocks are evicted to make room, and if the active block is the
+ * lowest it is dropped. */
+int
+UI_ReserveCommandSpace(ui_context *Ctx, size_t Size) {
+    if(Ctx->ActiveBlock->Dropped) {
+        return 0;
+    }
+    while(Ctx->ActiveBlock->Chunk->Size - Ctx->ActiveBlock->Chunk->Used < Size) {
+        if(!UI_RelocateActiveBlock(Ctx, Size) && !UI_EvictBlock(Ctx)) {
+            UI_DropActiveBlock(Ctx);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Returns the index of the block's reference or -1 if the block was dropped */
+int
+UI_BeginBlock(ui_context *Ctx, ui_id ID, int ZIndex) {
+    /* The discarded block stands in for the new block until it has a place, 
+     * evicting compares against its z-index */
+    UI_DiscardBlock(Ctx, ID, ZIndex);
+    ui_memory_chunk *Chunk = UI_FindCommandChunk(Ctx, sizeof(ui_command_block));
+    while(!Chunk && UI_EvictBlock(Ctx)) {
+        Chunk = UI_FindCommandChunk(Ctx, sizeof(ui_command_block));
+    }
+    ui_rect Root = (Ctx->Viewport.w > 0 && Ctx->Viewport.h > 0) ? Ctx->Viewport : UI_UNBOUNDED_RECT;
+    *UI_STACK_PUSH(Ctx->ClipStack, ui_rect) = Root;
+
+    ui_command_ref *CmdRef = Chunk ? UI_PushCommandRef(Ctx) : 0;
+    if(!CmdRef) {
+        Ctx->DroppedBlockCount++;
+        return -1;
+    }
+
+    ui_command_block *Block = (ui_command_block *)(UI_CHUNK_DATA(Chunk) + Chunk->Used);
+    Chunk->Used += sizeof(ui_command_block);
+    UI_InitBlock(Block, ID, ZIndex, Chunk);
+    Block->Clip = Root;
+    Ctx->ActiveBlock = Block;
+
+    CmdRef->Target = Block;
+    CmdRef->SortKey = -1;
+    Block->Ref = CmdRef - Ctx->CommandRefStack.Items;
+    return Block->Ref;
+}
+
+/* Command grouping */
+
+/* Commands of the same kind are drawn without a change of state */
+enum {
+    UI_GROUP_SOLID,
+    UI_GROUP_TEXTURED,
+    UI_GROUP_BARRIER /* Clip commands, nothing is moved across them */
+};
+
+/* A run that overlaps a command only by its bounds is searched command by 
+ * command if it's no longer than this */
+#define UI_GROUP_SCAN_MAX 64
+
+typedef struct {
+    unsigned int Offset;
+    int Next; /* Next entry in the new order, -1 for the last */
+} ui_group_entry;
+
+typedef struct {
+    int Kind;
+    int First, Last;
+    int Count;
+    ui_rect Bounds;
+} ui_group_run;
+
+/* Grows the rect command A to cover B and returns 1 if that draws the same 
+ * as drawing both */
+int
+UI_MergeRectCommands(ui_command *A, ui_command *B) {
+    if(A->Type != UI_COMMAND_RECT || B->Type != UI_COMMAND_RECT ||
+       memcmp(&A->Rect.Color, &B->Rect.Color, sizeof(ui_color))) {
+        return 0;
+    }
+    ui_rect *RA = &A->Rect.Rect, *RB = &B->Rect.Rect;
+    int Touching = (RA->y == RB->y && RA->h == RB->h && (RA->x + RA->w == RB->x || RB->x + RB->w == RA->x)) ||
+                   (RA->x == RB->x && RA->w == RB->w && (RA->y + RA->h == RB->y || RB->y + RB->h == RA->y));
+    ui_rect Union = UI_UnionRect(*RA, *RB);
+    int Covered = A->Rect.Color.a == 0xff && (UI_RectEquals(Union, *RA) || UI_RectEquals(Union, *RB));
+    if(Touching || Covered) {
+        *RA = Union;
+        return 1;
+    }
+    return 0;
+}
+
+int
+UI_RunOverlaps(ui_group_run *Run, ui_group_entry *Entries, unsigned char *Base, ui_rect Rect) {
+    if(!UI_RectsOverlap(Run->Bounds, Rect)) {
+        return 0;
+    }
+    if(Run->Count > UI_GROUP_SCAN_MAX) {
+        return 1;
+    }
+    for(int i = Run->First; i >= 0; i = Entries[i].Next) {
+        if(UI_RectsOverlap(((ui_command *)(Base + Entries[i].Offset))->Rect.Rect, Rect)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Each command joins the run of its kind at the end of the block, or the run
+ * before it if it doesn't overlap anything in the last run. The commands are
+ * then written back in the new order. The block must be at the end of its
+ * chunk as merging shrinks it. */
+void
+UI_GroupBlockCommands(ui_context *Ctx, ui_command_block *Block) {
+    size_t EntrySize = Block->CommandCount * sizeof(ui_group_entry);
+    size_t Size = EntrySize + Block->Size;
+    if(Ctx->GroupScratch.Size < Size) {
+        void *Memory = UI_Allocate(Ctx, 2 * Size);
+        if(!Memory) {
+            return;
+        }
+        if(Ctx->GroupScratch.Memory) {
+            UI_Deallocate(Ctx, Ctx->GroupScratch.Memory, Ctx->GroupScratch.Size);
+        }
+        Ctx->GroupScratch.Memory = Memory;
+        Ctx->GroupScratch.Size = 2 * Size;
+    }
+    ui_group_entry *Entries = Ctx->GroupScratch.Memory;
+    unsigned char *Base = (unsigned char *)Block;
+
+    ui_group_run Prev, Last;
+    memset(&Prev, 0, sizeof(Prev));
+    Prev.Kind = -1;
+    Last = Prev;
+    int Count = 0;
+    for(ui_command *Cmd = UI_BLOCK_BEGIN(Block); Cmd < UI_BLOCK_END(Block); Cmd = UI_NEXT_COMMAND(Cmd)) {
+        int Kind = (Cmd->Type == UI_COMMAND_RECT) ? UI_GROUP_SOLID :
+                   (Cmd->Type == UI_COMMAND_TEXT || Cmd->Type == UI_COMMAND_ICON) ? UI_GROUP_TEXTURED :
+                   UI_GROUP_BARRIER;
+        int Index = Count;
+        Entries[Index].Offset = (unsigned char *)Cmd - Base;
+        Entries[Index].Next = -1;
+
+        if(Kind != UI_GROUP_BARRIER && Kind == Last.Kind) {
+            if(UI_MergeRectCommands((ui_command *)(Base + Entries[Last.Last].Offset), Cmd)) {
+                Last.Bounds = UI_UnionRect(Last.Bounds, Cmd->Rect.Rect);
+                Ctx->MergedCommandCount++;
+                continue;
+            }
+            Entries[Last.Last].Next = Index;
+            Last.Last = Index;
+            Last.Count++;
+            Last.Bounds = UI_UnionRect(Last.Bounds, Cmd->Rect.Rect);
+        } else if(Kind != UI_GROUP_BARRIER && Kind == Prev.Kind && 
+                  !UI_RunOverlaps(&Last, Entries, Base, Cmd->Rect.Rect)) {
+            if(UI_MergeRectCommands((ui_command *)(Base + Entries[Prev.Last].Offset), Cmd)) {
+                Ctx->MergedCommandCount++;
+                continue;
+            }
+            Entries[Index].Next = Entries[Prev.Last].Next;
+            Entries[Prev.Last].Next = Index;
+            Prev.Last = Index;
+        } else {
+            if(Index > 0) {
+                Entries[Last.Last].Next = Index;
+            }
+            /* Nothing moves back across a barrier */
+            Prev = Last;
+            if(Kind == UI_GROUP_BARRIER) {
+                Prev.Kind = -1;
+            }
+            Last.Kind = Kind;
+            Last.First = Last.Last = Index;
+            Last.Count = 1;
+            /* Clip commands have no Color, and POP_CLIP no rect either */
+            Last.Bounds = (Kind == UI_GROUP_BARRIER) ? UI_Rect(0, 0, 0, 0) : Cmd->Rect.Rect;
+        }
+        Count++;
+    }
+
+    unsigned char *Copy = (unsigned char *)Entries + EntrySize;
+    size_t Used = 0;
+    for(int i = Count ? 0 : -1; i >= 0; i = Entries[i].Next) {
+        ui_command *Cmd = (ui_command *)(Base + Entries[i].Offset);
+        memcpy(Copy + Used, Cmd, Cmd->Header.Size);
+        Used += Cmd->Header.Size;
+    }
+    memcpy(UI_BLOCK_BEGIN(Block), Copy, Used);
+
+    size_t Merged = Block->Size - sizeof(ui_command_block) - Used;
+    Block->Chunk->Used -= Merged;
+    Block->Size -= Merged;
+    Block->TypeCount[UI_COMMAND_RECT] -= Block->CommandCount - Count;
+    Block->CommandCount = Count;
+}
+
+/* Closes the active block and resumes the paused block if there is one */
+void
+UI_EndBlock(ui_context *Ctx) {
+    if(Ctx->GroupCommands && !Ctx->ActiveBlock->Dropped) {
+        UI_GroupBlockCommands(Ctx, Ctx->ActiveBlock);
+    }
+    if(Ctx->MemoryBudget && !Ctx->ActiveBlock->Dropped) {
+        UI_PushClosedBlock(Ctx, Ctx->ActiveBlock->Ref);
+    }
+    Ctx->ClipStack.Index--;
+    Ctx->ActiveBlock = Ctx->PausedBlock;
+    Ctx->PausedBlock = 0;
+}
+
+/* Commands are aligned to pointers as text commands hold one */
+#define UI_COMMAND_SIZE(Type) ((sizeof(Type) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/* The fast path is a bump of the active block's chunk, everything else is 
+ * handled by UI_ReserveCommandSpace */
+static inline void *
+UI_PushCommand(ui_context *Ctx, int Type, size_t Size) {
+    ui_command_block *Block = Ctx->ActiveBlock;
+    UI_ASSERT(Block, "Commands must be pushed between UI_Window and UI_EndWindow");
+    if(Block->Dropped || Block->Chunk->Size - Block->Chunk->Used < Size) {
+        if(!UI_ReserveCommandSpace(Ctx, Size)) {
+            Ctx->DroppedCommandCount++;
+            return &Ctx->DiscardedCommand;
+        }
+        Block = Ctx->ActiveBlock;
+    }
+    ui_command_header *Result = (ui_command_header *)(UI_CHUNK_DATA(Block->Chunk) + Block->Chunk->Used);
+    Result->Type = Type;
+    Result->Size = Size;
+    Block->Chunk->Used += Size;
+    Block->Size += Size;
+    Block->CommandCount++;
+    Block->TypeCount[Type]++;
+    return Result;
+}
+
+/* Window grid */
+
+/* Cell of a point, points outside of the grid are in the cells at its edge */
+int
+UI_WindowGridCell(ui_context *Ctx, int x, int y) {
+    ui_rect Bounds = Ctx->WindowGrid.Bounds;
+    long long Column = ((long long)x - Bounds.x) * UI_WINDOW_GRID_SIZE / Bounds.w;
+    long long Row = ((long long)y - Bounds.y) * UI_WINDOW_GRID_SIZE / Bounds.h;
+    Column = UI_MIN(UI_MAX(Column, 0), UI_WINDOW_GRID_SIZE - 1);
+    Row = UI_MIN(UI_MAX(Row, 0), UI_WINDOW_GRID_SIZE - 1);
+    return Row * UI_WINDOW_GRID_SIZE + Column;
+}
+
+/* Lists the windows of the frame in every cell their rect overlaps. The 
+ * lists are sorted by cell, CellStart has the first item of each cell. */
+void
+UI_BuildWindowGrid(ui_context *Ctx) {
+    Ctx->WindowGrid.Valid = 0;
+    ui_rect Bounds = Ctx->Viewport;
+    if(Bounds.w <= 0 || Bounds.h <= 0) {
+        Bounds = UI_Rect(0, 0, 0, 0);
+        for(ui_window *Window = Ctx->WindowBottom; Window; Window = Window->Above) {
+            Bounds = UI_UnionRect(Bounds, Window->Rect);
+        }
+        if(Bounds.w <= 0 || Bounds.h <= 0) {
+            return;
+        }
+    }
+    Ctx->WindowGrid.Bounds = Bounds;
+
+    unsigned int *CellStart = Ctx->WindowGrid.CellStart;
+    memset(CellStart, 0, sizeof(Ctx->WindowGrid.CellStart));
+    for(int Pass = 0; Pass < 2; Pass++) {
+        unsigned int Fill[UI_WINDOW_GRID_SIZE * UI_WINDOW_GRID_SIZE];
+        if(Pass == 1) {
+            for(int i = 0; i < UI_WINDOW_GRID_SIZE * UI_WINDOW_GRID_SIZE; i++) {
+                CellStart[i + 1] += CellStart[i];
+                Fill[i] = CellStart[i];
+            }
+            unsigned int Count = CellStart[UI_WINDOW_GRID_SIZE * UI_WINDOW_GRID_SIZE];
+            if(Count > Ctx->WindowGrid.Capacity) {
+                unsigned int Capacity = UI_MAX(256, Ctx->WindowGrid.Capacity * 2);
+                while(Capacity < Count) {
+                    Capacity *= 2;
+                }
+                ui_window **Items = UI_Allocate(Ctx, Capacity * sizeof(ui_window *));
+                if(!Items) {
+                    return;
+                }
+                if(Ctx->WindowGrid.Items) {
+                    UI_Deallocate(Ctx, Ctx->WindowGrid.Items, Ctx->WindowGrid.Capacity * sizeof(ui_window *));
+                }
+                Ctx->WindowGrid.Items = Items;
+                Ctx->WindowGrid.Capacity = Capacity;
+            }
+        }
+        for(ui_window *Window = Ctx->WindowBottom; Window; Window = Window->Above) {
+            if(Window->Frame != Ctx->Frame) {
+                continue;
+            }
+            ui_rect R = Window->Rect;
+            int First = UI_WindowGridCell(Ctx, R.x, R.y);
+            int Last = UI_WindowGridCell(Ctx, R.x + R.w, R.y + R.h);
+            for(int Row = First / UI_WINDOW_GRID_SIZE; Row <= Last / UI_WINDOW_GRID_SIZE; Row++) {
+                for(int Column = First % UI_WINDOW_GRID_SIZE; Column <= Last % UI_WINDOW_GRID_SIZE; Column++) {
+                    int Cell = Row * UI_WINDOW_GRID_SIZE + Column;
+                    if(Pass == 0) {
+                        CellStart[Cell + 1]++;
+                    } else {
+                        Ctx->WindowGrid.Items[Fill[Cell]++] = Window;
+                    }
+                }
+            }
+        }
+    }
+    Ctx->WindowGrid.Valid = 1;
+}
+
+/* The topmost window under P. Without a grid the windows built in this or the
+ * last frame are tested top down. */
+ui_window *
+UI_WindowAt(ui_context *Ctx, ui_v2 P) {
+    ui_window *Result = 0;
+    if(Ctx->WindowGrid.Valid) {
+        int Cell = UI_WindowGridCell(Ctx, P.x, P.y);
+        for(unsigned int i = Ctx->WindowGrid.CellStart[Cell]; i < Ctx->WindowGrid.CellStart[Cell + 1]; i++) {
+            ui_window *Window = Ctx->WindowGrid.Items[i];
+            if((!Result || Window->ZIndex > Result->ZIndex) && UI_PointInsideRect(Window->Rect, P)) {
+                Result = Window;
+            }
+        }
     } else {
-        UI_ABORT("Invalid direction");
+        for(ui_window *Window = Ctx->WindowTop; Window; Window = Window->Below) {
+            if(Window->Frame + 1 >= Ctx->Frame && UI_PointInsideRect(Window->Rect, P)) {
+                Result = Window;
+                break;
+            }
+        }
     }
     return Result;
 }
 
-ui_command *
-UI_PushCommand(ui_context *Ctx) {
-    return UI_PushCommandEx(Ctx, Ctx->ActiveBlock->Direction);
+ui_window *
+UI_RootWindow(ui_window *Window) {
+    while(Window->Parent) {
+        Window = Window->Parent;
+    }
+    return Window;
+}
+
+/* Widget state */
+
+/* Returns the slot of ID in the index of the states, or the empty slot it
+ * would go in. Probes is the number of slots looked at. */
+ui_state **
+UI_StateSlot(ui_context *Ctx, ui_id ID, unsigned int *Probes) {
+    unsigned int Mask = Ctx->States.Capacity - 1;
+    unsigned int i = ID & Mask;
+    *Probes = 1;
+    while(Ctx->States.Slots[i] && Ctx->States.Slots[i]->ID != ID) {
+        i = (i + 1) & Mask;
+        (*Probes)++;
+    }
+    return &Ctx->States.Slots[i];
+}
+
+void
+UI_LinkState(ui_state **List, ui_state *State) {
+    State->Prev = 0;
+    State->Next = *List;
+    if(*List) {
+        (*List)->Prev = State;
+    }
+    *List = State;
+}
+
+void
+UI_UnlinkState(ui_state **List, ui_state *State) {
+    if(State->Prev) {
+        State->Prev->Next = State->Next;
+    } else {
+        *List = State->Next;
+    }
+    if(State->Next) {
+        State->Next->Prev = State->Prev;
+    }
+}
+
+/* Every state is in either list, so the index is rebuilt from them */
+void
+UI_GrowStateIndex(ui_context *Ctx) {
+    if(Ctx->States.Slots) {
+        UI_Deallocate(Ctx, Ctx->States.Slots, Ctx->States.Capacity * sizeof(ui_state *));
+    }
+    Ctx->States.Capacity = UI_MAX(64, Ctx->States.Capacity * 2);
+    Ctx->States.Slots = UI_AllocateWindowMemory(Ctx, Ctx->States.Capacity * sizeof(ui_state *));
+    ui_state *Lists[2];
+    Lists[0] = Ctx->States.Touched;
+    Lists[1] = Ctx->States.Untouched;
+    for(int i = 0; i < 2; i++) {
+        for(ui_state *State = Lists[i]; State; State = State->Next) {
+            unsigned int Probes;
+            *UI_StateSlot(Ctx, State->ID, &Probes) = State;
+        }
+    }
+}
+
+/* Removes the state in Slot from the index. The states after it in the same
+ * run of full slots are moved back into the gap unless that would put them
+ * before the slot they hash to, so lookups never need tombstones. */
+void
+UI_RemoveStateSlot(ui_context *Ctx, ui_state **Slot) {
+    unsigned int Mask = Ctx->States.Capacity - 1;
+    unsigned int Gap = (unsigned int)(Slot - Ctx->States.Slots);
+    for(unsigned int i = (Gap + 1) & Mask; Ctx->States.Slots[i]; i = (i + 1) & Mask) {
+        unsigned int Home = Ctx->States.Slots[i]->ID & Mask;
+        if(((i - Home) & Mask) >= ((i - Gap) & Mask)) {
+            Ctx->States.Slots[Gap] = Ctx->States.Slots[i];
+            Gap = i;
+        }
+    }
+    Ctx->States.Slots[Gap] = 0;
+}
+
+void *
+UI_GetState(ui_context *Ctx, ui_id ID, size_t Size) {
+    UI_ASSERT(Size <= UI_STATE_SIZE, "The state is larger than UI_STATE_SIZE");
+    if(2 * (Ctx->States.Count + 1) > Ctx->States.Capacity) {
+        UI_GrowStateIndex(Ctx);
+    }
+    unsigned int Probes;
+    ui_state **Slot = UI_StateSlot(Ctx, ID, &Probes);
+    Ctx->States.LookupCount++;
+    Ctx->States.ProbeCount += Probes;
+    Ctx->States.ProbeMax = UI_MAX(Ctx->States.ProbeMax, Probes);
+
+    ui_state *State = *Slot;
+    if(!State) {
+        State = Ctx->States.Free;
+        if(State) {
+            Ctx->States.Free = State->Next;
+        } else {
+            ui_state_page *Page = Ctx->States.Pages;
+            if(!Page || Page->Count == UI_STATE_PAGE_SIZE) {
+                Page = UI_AllocateWindowMemory(Ctx, sizeof(ui_state_page));
+                Page->Next = Ctx->States.Pages;
+                Ctx->States.Pages = Page;
+            }
+            State = &Page->Items[Page->Count++];
+        }
+        State->ID = ID;
+        State->Frame = Ctx->Frame;
+        memset(&State->Data, 0, sizeof(State->Data));
+        UI_LinkState(&Ctx->States.Touched, State);
+        *Slot = State;
+        Ctx->States.Count++;
+    } else if(State->Frame != Ctx->Frame) {
+        UI_UnlinkState(&Ctx->States.Untouched, State);
+        UI_LinkState(&Ctx->States.Touched, State);
+        State->Frame = Ctx->Frame;
+    }
+    State->Window = Ctx->WindowSelected ? UI_RootWindow(Ctx->WindowSelected) : 0;
+    return &State->Data;
+}
+
+/* The states that weren't asked for this frame go to the free list unless
+ * their window was begun but skipped its body, the others are the untouched
+ * of the next frame */
+void
+UI_EvictStates(ui_context *Ctx) {
+    for(ui_state *State = Ctx->States.Untouched; State;) {
+        ui_state *Next = State->Next;
+        ui_window *Window = State->Window;
+        if(Window && Window->Frame == Ctx->Frame && Window->BodySkipped) {
+            UI_LinkState(&Ctx->States.Touched, State);
+        } else {
+            unsigned int Probes;
+            UI_RemoveStateSlot(Ctx, UI_StateSlot(Ctx, State->ID, &Probes));
+            State->Next = Ctx->States.Free;
+            Ctx->States.Free = State;
+            Ctx->States.Count--;
+            Ctx->States.EvictedCount++;
+        }
+        State = Next;
+    }
+    Ctx->States.Untouched = Ctx->States.Touched;
+    Ctx->States.Touched = 0;
 }
 
 void
 UI_Begin(ui_context *Ctx) {
-    Ctx->TextBufferTop = 0;
-    Ctx->CommandStack.Index = 0;
-    Ctx->CommandStack.Index2 = UI_COMMAND_MAX - 1;
+    Ctx->Frame++;
+    if(Ctx->ZIndexTop > UI_ZINDEX_RENORMALIZE) {
+        Ctx->ZIndexTop = 0;
+        for(ui_window *Window = Ctx->WindowBottom; Window; Window = Window->Above) {
+            Window->ZIndex = Ctx->ZIndexTop++;
+        }
+    }
+    Ctx->HotPrev = Ctx->Hot;
+    Ctx->HoverWindow = UI_WindowAt(Ctx, Ctx->MousePos);
+    for(ui_memory_chunk *Chunk = Ctx->CommandChunks; Chunk; Chunk = Chunk->Next) {
+        Chunk->Used = 0;
+    }
+    Ctx->TextChunk = Ctx->TextChunks;
+    if(Ctx->TextChunk) {
+        Ctx->TextChunk->Used = 0;
+    }
     Ctx->CommandRefStack.Index = 0;
-    Ctx->CmdIndex = 0;
+    Ctx->ClosedBlocks.Count = 0;
+    Ctx->CmdOffset = 0;
     Ctx->CmdRefIndex = 0;
+    Ctx->BlockRefIndex = 0;
+    Ctx->ClipStack.Index = 0;
+    Ctx->CulledCommandCount = 0;
+    Ctx->MergedCommandCount = 0;
+    Ctx->OccludedCommandCount = 0;
+    Ctx->OccludedBlockCount = 0;
+    Ctx->ReplayHitCount = 0;
+    Ctx->ReplayMissCount = 0;
+    Ctx->DroppedBlockCount = 0;
+    Ctx->DroppedCommandCount = 0;
+    Ctx->DroppedTextCount = 0;
+    Ctx->States.LookupCount = 0;
+    Ctx->States.ProbeCount = 0;
+    Ctx->States.ProbeMax = 0;
+    Ctx->States.EvictedCount = 0;
+    Ctx->TextCache.HitCount = 0;
+    Ctx->TextCache.MissCount = 0;
+    Ctx->TextCache.EvictedCount = 0;
+}
+
+void
+UI_Release(ui_context *Ctx) {
+    UI_FreeChunks(Ctx, Ctx->CommandChunks);
+    UI_FreeChunks(Ctx, Ctx->TextChunks);
+    if(Ctx->CommandRefStack.Items) {
+        UI_Deallocate(Ctx, Ctx->CommandRefStack.Items, Ctx->CommandRefStack.Capacity * sizeof(ui_command_ref));
+    }
+    if(Ctx->ClosedBlocks.Items) {
+        UI_Deallocate(Ctx, Ctx->ClosedBlocks.Items, Ctx->ClosedBlocks.Capacity * sizeof(int));
+    }
+    if(Ctx->GroupScratch.Memory) {
+        UI_Deallocate(Ctx, Ctx->GroupScratch.Memory, Ctx->GroupScratch.Size);
+    }
+    for(int i = 0; i < 2; i++) {
+        ui_frame_digest *Digest = &Ctx->Digests[i];
+        if(Digest->Commands.Items) {
+            UI_Deallocate(Ctx, Digest->Commands.Items, Digest->Commands.Capacity * sizeof(ui_command_digest));
+        }
+        if(Digest->Blocks.Items) {
+            UI_Deallocate(Ctx, Digest->Blocks.Items, Digest->Blocks.Capacity * sizeof(ui_block_digest));
+        }
+        Digest->Commands.Items = 0;
+        Digest->Commands.Index = Digest->Commands.Capacity = 0;
+        Digest->Blocks.Items = 0;
+        Digest->Blocks.Index = Digest->Blocks.Capacity = 0;
+        Digest->Valid = 0;
+    }
+    for(ui_window_page *Page = Ctx->WindowPages; Page;) {
+        ui_window_page *Next = Page->Next;
+        for(unsigned int i = 0; i < Page->Count; i++) {
+            ui_window_cache *Cache = &Page->Items[i].Cache;
+            if(Cache->Memory) {
+                UI_Deallocate(Ctx, Cache->Memory, Cache->Capacity);
+            }
+            if(Page->Items[i].Layouts.Items) {
+                UI_Deallocate(Ctx, Page->Items[i].Layouts.Items, Page->Items[i].Layouts.Capacity * sizeof(ui_columns));
+            }
+        }
+        UI_Deallocate(Ctx, Page, sizeof(ui_window_page));
+        Page = Next;
+    }
+    if(Ctx->WindowIndex.Slots) {
+        UI_Deallocate(Ctx, Ctx->WindowIndex.Slots, Ctx->WindowIndex.Capacity * sizeof(ui_window *));
+    }
+    for(ui_state_page *Page = Ctx->States.Pages; Page;) {
+        ui_state_page *Next = Page->Next;
+        UI_Deallocate(Ctx, Page, sizeof(ui_state_page));
+        Page = Next;
+    }
+    if(Ctx->States.Slots) {
+        UI_Deallocate(Ctx, Ctx->States.Slots, Ctx->States.Capacity * sizeof(ui_state *));
+    }
+    memset(&Ctx->States, 0, sizeof(Ctx->States));
+    if(Ctx->TextCache.Items) {
+        UI_Deallocate(Ctx, Ctx->TextCache.Items, UI_TEXT_CACHE_SIZE * sizeof(ui_text_width));
+    }
+    memset(&Ctx->TextCache, 0, sizeof(Ctx->TextCache));
+    if(Ctx->WindowGrid.Items) {
+        UI_Deallocate(Ctx, Ctx->WindowGrid.Items, Ctx->WindowGrid.Capacity * sizeof(ui_window *));
+    }
+    Ctx->WindowGrid.Items = 0;
+    Ctx->WindowGrid.Capacity = 0;
+    Ctx->WindowGrid.Valid = 0;
+    Ctx->HoverWindow = Ctx->EventWindow = 0;
+    Ctx->WindowPages = 0;
+    Ctx->WindowCount = 0;
+    Ctx->WindowIndex.Slots = 0;
+    Ctx->WindowIndex.Capacity = 0;
+    Ctx->WindowBottom = Ctx->WindowTop = Ctx->WindowSelected = 0;
+    Ctx->ZIndexTop = 0;
+    Ctx->CommandChunks = Ctx->TextChunks = Ctx->TextChunk = 0;
+    Ctx->GroupScratch.Memory = 0;
+    Ctx->GroupScratch.Size = 0;
+    Ctx->CommandRefStack.Items = 0;
+    Ctx->CommandRefStack.Index = Ctx->CommandRefStack.Capacity = 0;
+    Ctx->ClosedBlocks.Items = 0;
+    Ctx->ClosedBlocks.Count = Ctx->ClosedBlocks.Capacity = 0;
+}
+
+/* The depth order of the windows is the draw order so no sorting is needed.
+ * Blocks are given their position in the draw order, window blocks from the
+ * bottom window up, then the pop-up blocks and last the dropped blocks that
+ * are cut off. The references are then moved to their positions. */
+void
+UI_OrderCommandRefs(ui_context *Ctx) {
+    ui_command_ref *Refs = Ctx->CommandRefStack.Items;
+    int Count = Ctx->CommandRefStack.Index;
+    int Position = 0;
+    for(ui_window *Window = Ctx->WindowBottom; Window; Window = Window->Above) {
+        if(Window->Frame == Ctx->Frame && Window->BlockRef >= 0 && Refs[Window->BlockRef].Target) {
+            Refs[Window->BlockRef].SortKey = Position++;
+        }
+    }
+    for(int i = 0; i < Count; i++) {
+        if(Refs[i].Target && Refs[i].SortKey < 0) {
+            Refs[i].SortKey = Position++;
+        }
+    }
+    Ctx->CommandRefStack.Index = Position;
+    for(int i = 0; i < Count; i++) {
+        if(!Refs[i].Target) {
+            Refs[i].SortKey = Position++;
+        }
+    }
+
+    /* The sort keys are a permutation, follow its cycles */
+    for(int i = 0; i < Count; i++) {
+        while(Refs[i].SortKey != i) {
+            ui_command_ref T = Refs[Refs[i].SortKey];
+            Refs[Refs[i].SortKey] = Refs[i];
+            Refs[i] = T;
+        }
+    }
+}
+
+/* Visits the blocks front to back and drops the commands that are inside
+ * the opaque rect of a block in front of them. A block is dropped whole if its
+ * bounds are inside one of them. Only the opaque rects overlapping a block's 
+ * bounds are tested against its commands. */
+void
+UI_CullOccludedBlocks(ui_context *Ctx) {
+    ui_rect Occluders[UI_OCCLUDER_MAX];
+    int OccluderCount = 0;
+    ui_command_ref *Refs = Ctx->CommandRefStack.Items;
+    for(int i = Ctx->CommandRefStack.Index - 1; i >= 0; i--) {
+        ui_command_block *Block = Refs[i].Target;
+        ui_rect Near[UI_OCCLUDER_MAX];
+        int NearCount = 0;
+        for(int j = 0; j < OccluderCount && Block; j++) {
+            if(UI_RectContains(Occluders[j], Block->Bounds)) {
+                Ctx->OccludedBlockCount++;
+                Ctx->OccludedCommandCount += Block->CommandCount;
+                Refs[i].Target = Block = 0;
+            } else if(UI_RectsOverlap(Occluders[j], Block->Bounds)) {
+                Near[NearCount++] = Occluders[j];
+            }
+        }
+        if(!Block) {
+            continue;
+        }
+
+        if(NearCount) {
+            /* The bounds are rebuilt from the visible parts of the commands
+             * that are kept. Everything visible is inside the old bounds so
+             * they're the clip rect the block starts with. */
+            ui_rect Clips[UI_CLIP_STACK_MAX];
+            int ClipIndex = 0;
+            Clips[0] = Block->Bounds;
+            ui_rect Bounds = UI_Rect(0, 0, 0, 0);
+            unsigned char *Write = (unsigned char *)UI_BLOCK_BEGIN(Block);
+            ui_command *End = UI_BLOCK_END(Block);
+            for(ui_command *Cmd = UI_BLOCK_BEGIN(Block); Cmd < End;) {
+                ui_command *Next = UI_NEXT_COMMAND(Cmd);
+                int Covered = 0;
+                if(Cmd->Type == UI_COMMAND_RECT || Cmd->Type == UI_COMMAND_TEXT || Cmd->Type == UI_COMMAND_ICON) {
+                    for(int j = 0; j < NearCount && !Covered; j++) {
+                        Covered = UI_RectContains(Near[j], Cmd->Rect.Rect);
+                    }
+                    if(!Covered) {
+                        Bounds = UI_UnionRect(Bounds, UI_IntersectRect(Cmd->Rect.Rect, Clips[ClipIndex]));
+                    }
+                } else if(Cmd->Type == UI_COMMAND_PUSH_CLIP) {
+                    UI_ASSERT(ClipIndex + 1 < UI_CLIP_STACK_MAX, "Clip stack overflow");
+                    Clips[ClipIndex + 1] = UI_IntersectRect(Cmd->Clip.Rect, Clips[ClipIndex]);
+                    ClipIndex++;
+                } else if(Cmd->Type == UI_COMMAND_POP_CLIP) {
+                    ClipIndex--;
+                } else if(Cmd->Type == UI_COMMAND_CLIP) {
+                    Clips[ClipIndex] = UI_IntersectRect(Cmd->Clip.Rect, Block->Bounds);
+                }
+                if(Covered) {
+                    Block->CommandCount--;
+                    Block->TypeCount[Cmd->Type]--;
+                    Ctx->OccludedCommandCount++;
+                } else {
+                    /* The move can overwrite the header when the gap is smaller than the command */
+                    unsigned short Size = Cmd->Header.Size;
+                    if(Write != (unsigned char *)Cmd) {
+                        memmove(Write, Cmd, Size);
+                    }
+                    Write += Size;
+                }
+                Cmd = Next;
+            }
+            Block->Size = Write - (unsigned char *)Block;
+            Block->Bounds = Bounds;
+        }
+
+        if(Block->Opaque.w > 0 && Block->Opaque.h > 0 && OccluderCount < UI_OCCLUDER_MAX) {
+            Occluders[OccluderCount++] = Block->Opaque;
+        }
+    }
+
+    /* Close the gaps of the dropped blocks, keeping the draw order */
+    int Count = 0;
+    for(int i = 0; i < Ctx->CommandRefStack.Index; i++) {
+        if(Refs[i].Target) {
+            Refs[Count++] = Refs[i];
+        }
+    }
+    Ctx->CommandRefStack.Index = Count;
+}
+
+/* Damage */
+
+unsigned int
+UI_HashBytes(void *Data, size_t Size, unsigned int Hash) {
+    unsigned char *Bytes = Data;
+    for(size_t i = 0; i < Size; i++) {
+        Hash = (Hash ^ Bytes[i]) * 16777619;
+    }
+    return Hash;
+}
+
+/* Hashes the fields of a command, not its bytes, as those have padding */
+unsigned int
+UI_HashCommand(ui_command *Cmd) {
+    unsigned int Hash = UI_HashBytes(&Cmd->Type, sizeof(Cmd->Type), 2166136261);
+    switch(Cmd->Type) {
+        case UI_COMMAND_PUSH_CLIP:
+        case UI_COMMAND_CLIP: {
+            Hash = UI_HashBytes(&Cmd->Clip.Rect, sizeof(ui_rect), Hash);
+        } break;
+        case UI_COMMAND_RECT:
+        case UI_COMMAND_TEXT:
+        case UI_COMMAND_ICON: {
+            Hash = UI_HashBytes(&Cmd->Rect.Color, sizeof(ui_color), Hash);
+            Hash = UI_HashBytes(&Cmd->Rect.Rect, sizeof(ui_rect), Hash);
+            if(Cmd->Type == UI_COMMAND_TEXT) {
+                Hash = UI_HashCombine(Hash, UI_HashStr(UI_Str(Cmd->Text.Text, Cmd->Text.Length)));
+            } else if(Cmd->Type == UI_COMMAND_ICON) {
+                Hash = UI_HashBytes(&Cmd->Icon.ID, sizeof(int), Hash);
+            }
+        } break;
+    }
+    return Hash;
+}
+
+/* Adds Rect to the damage rects, merging it with the rects it overlaps. When
+ * the list is full it's merged with the rect that grows the least. */
+void
+UI_AddDamage(ui_context *Ctx, ui_rect Rect) {
+    if(Ctx->Viewport.w > 0 && Ctx->Viewport.h > 0) {
+        Rect = UI_IntersectRect(Rect, Ctx->Viewport);
+    }
+    if(Rect.w <= 0 || Rect.h <= 0) {
+        return;
+    }
+    for(int i = 0; i < Ctx->DamageRectCount; i++) {
+        if(UI_RectsOverlap(Ctx->DamageRects[i], Rect)) {
+            Rect = UI_UnionRect(Rect, Ctx->DamageRects[i]);
+            Ctx->DamageRects[i--] = Ctx->DamageRects[--Ctx->DamageRectCount];
+        }
+    }
+    if(Ctx->DamageRectCount == UI_DAMAGE_RECT_MAX) {
+        int Best = 0;
+        long long BestGrowth = -1;
+        for(int i = 0; i < Ctx->DamageRectCount; i++) {
+            ui_rect U = UI_UnionRect(Rect, Ctx->DamageRects[i]);
+            long long Growth = (long long)U.w * U.h - (long long)Ctx->DamageRects[i].w * Ctx->DamageRects[i].h;
+            if(BestGrowth < 0 || Growth < BestGrowth) {
+                Best = i;
+                BestGrowth = Growth;
+            }
+        }
+        Rect = UI_UnionRect(Rect, Ctx->DamageRects[Best]);
+        Ctx->DamageRects[Best] = Ctx->DamageRects[--Ctx->DamageRectCount];
+        UI_AddDamage(Ctx, Rect);
+        return;
+    }
+    Ctx->DamageRects[Ctx->DamageRectCount++] = Rect;
+}
+
+/* The blocks are mostly in the same order in both frames, the search starts
+ * at Hint and wraps around */
+int
+UI_FindBlockDigest(ui_frame_digest *Digest, ui_id ID, unsigned int Hint) {
+    unsigned int Count = Digest->Blocks.Index;
+    for(unsigned int n = 0; n < Count; n++) {
+        unsigned int i = (Hint + n) % Count;
+        if(Digest->Blocks.Items[i].ID == ID) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Records what the blocks of this frame draw and damages what differs from
+ * the previous frame:
+ * - Blocks that are new, gone, or drew something different in a different 
+ *   place damage their old and new bounds.
+ * - Blocks that drew the same number of commands in the same places only
+ *   damage the rects of the commands that changed.
+ * - Overlapping blocks that swapped places in the draw order damage their
+ *   intersection. */
+void
+UI_TrackDamage(ui_context *Ctx) {
+    ui_frame_digest *Digest = &Ctx->Digests[Ctx->Frame & 1];
+    ui_frame_digest *Prev = &Ctx->Digests[(Ctx->Frame + 1) & 1];
+    Ctx->DamageRectCount = 0;
+
+    Digest->Valid = 1;
+    Digest->Frame = Ctx->Frame;
+    Digest->Viewport = Ctx->Viewport;
+    Digest->Blocks.Index = 0;
+    Digest->Commands.Index = 0;
+    for(int i = 0; i < Ctx->CommandRefStack.Index; i++) {
+        ui_command_block *Block = Ctx->CommandRefStack.Items[i].Target;
+        if(Digest->Blocks.Index == Digest->Blocks.Capacity) {
+            unsigned int Capacity = UI_MAX(64, Digest->Blocks.Capacity * 2);
+            ui_block_digest *Items = UI_Allocate(Ctx, Capacity * sizeof(ui_block_digest));
+            if(!Items) {
+                Digest->Valid = 0;
+                break;
+            }
+            if(Digest->Blocks.Items) {
+                memcpy(Items, Digest->Blocks.Items, Digest->Blocks.Index * sizeof(ui_block_digest));
+                UI_Deallocate(Ctx, Digest->Blocks.Items, Digest->Blocks.Capacity * sizeof(ui_block_digest));
+            }
+            Digest->Blocks.Items = Items;
+            Digest->Blocks.Capacity = Capacity;
+        }
+        if(Digest->Commands.Index + Block->CommandCount > Digest->Commands.Capacity) {
+            unsigned int Capacity = UI_MAX(1024, Digest->Commands.Capacity * 2);
+            while(Capacity < Digest->Commands.Index + Block->CommandCount) {
+                Capacity *= 2;
+            }
+            ui_command_digest *Items = UI_Allocate(Ctx, Capacity * sizeof(ui_command_digest));
+            if(!Items) {
+                Digest->Valid = 0;
+                break;
+            }
+            if(Digest->Commands.Items) {
+                memcpy(Items, Digest->Commands.Items, Digest->Commands.Index * sizeof(ui_command_digest));
+                UI_Deallocate(Ctx, Digest->Commands.Items, Digest->Commands.Capacity * sizeof(ui_command_digest));
+            }
+            Digest->Commands.Items = Items;
+            Digest->Commands.Capacity = Capacity;
+        }
+
+        ui_block_digest *BlockDigest = &Digest->Blocks.Items[Digest->Blocks.Index++];
+        BlockDigest->ID = Block->ID;
+        BlockDigest->Bounds = Block->Bounds;
+        BlockDigest->First = Digest->Commands.Index;
+        BlockDigest->Count = 0;
+        BlockDigest->Hash = 2166136261;
+        for(ui_command *Cmd = UI_BLOCK_BEGIN(Block); Cmd < UI_BLOCK_END(Block); Cmd = UI_NEXT_COMMAND(Cmd)) {
+            ui_command_digest *CmdDigest = &Digest->Commands.Items[Digest->Commands.Index++];
+            CmdDigest->Hash = UI_HashCommand(Cmd);
+            CmdDigest->Type = Cmd->Type;
+            CmdDigest->Rect = (Cmd->Type == UI_COMMAND_RECT || Cmd->Type == UI_COMMAND_TEXT || 
+                               Cmd->Type == UI_COMMAND_ICON) ? Cmd->Rect.Rect : UI_Rect(0, 0, 0, 0);
+            BlockDigest->Hash = UI_HashBytes(&CmdDigest->Hash, sizeof(unsigned int), BlockDigest->Hash);
+            BlockDigest->Count++;
+        }
+    }
+
+    /* Prev is only the previous frame if that frame was tracked too */
+    int PrevValid = Prev->Valid && Prev->Frame + 1 == Ctx->Frame;
+    if(!Digest->Valid || !PrevValid || !UI_RectEquals(Prev->Viewport, Ctx->Viewport)) {
+        ui_rect All = Ctx->Viewport;
+        if(All.w <= 0 || All.h <= 0) {
+            All = UI_Rect(0, 0, 0, 0);
+            for(int i = 0; i < Digest->Blocks.Index; i++) {
+                All = UI_UnionRect(All, Digest->Blocks.Items[i].Bounds);
+            }
+            for(int i = 0; i < Prev->Blocks.Index && PrevValid; i++) {
+                All = UI_UnionRect(All, Prev->Blocks.Items[i].Bounds);
+            }
+        }
+        UI_AddDamage(Ctx, All);
+        return;
+    }
+
+    for(int i = 0; i < Prev->Blocks.Index; i++) {
+        Prev->Blocks.Items[i].Match = -1;
+    }
+    int InOrder = 1;
+    int LastIndex = -1;
+    for(int i = 0; i < Digest->Blocks.Index; i++) {
+        ui_block_digest *Block = &Digest->Blocks.Items[i];
+        Block->Match = UI_FindBlockDigest(Prev, Block->ID, LastIndex + 1);
+        ui_block_digest *Old = Block->Match < 0 ? 0 : &Prev->Blocks.Items[Block->Match];
+        if(Old) {
+            InOrder &= Block->Match > LastIndex;
+            LastIndex = Block->Match;
+            Old->Match = i;
+        }
+        if(!Old) {
+            UI_AddDamage(Ctx, Block->Bounds);
+        } else if(Old->Hash == Block->Hash && UI_RectEquals(Old->Bounds, Block->Bounds)) {
+            /* Unchanged */
+        } else if(Old->Count == Block->Count) {
+            ui_command_digest *OldCmds = Prev->Commands.Items + Old->First;
+            ui_command_digest *Cmds = Digest->Commands.Items + Block->First;
+            for(int j = 0; j < Block->Count; j++) {
+                if(OldCmds[j].Hash != Cmds[j].Hash) {
+                    UI_AddDamage(Ctx, OldCmds[j].Rect);
+                    UI_AddDamage(Ctx, Cmds[j].Rect);
+                    /* A clip command changes everything after it */
+                    if(Cmds[j].Type == UI_COMMAND_PUSH_CLIP || Cmds[j].Type == UI_COMMAND_POP_CLIP ||
+                       Cmds[j].Type == UI_COMMAND_CLIP || OldCmds[j].Type != Cmds[j].Type) {
+                        UI_AddDamage(Ctx, Old->Bounds);
+                        UI_AddDamage(Ctx, Block->Bounds);
+                        break;
+                    }
+                }
+            }
+        } else {
+            UI_AddDamage(Ctx, Old->Bounds);
+            UI_AddDamage(Ctx, Block->Bounds);
+        }
+    }
+
+    /* Vacated areas */
+    for(int i = 0; i < Prev->Blocks.Index; i++) {
+        if(Prev->Blocks.Items[i].Match < 0) {
+            UI_AddDamage(Ctx, Prev->Blocks.Items[i].Bounds);
+        }
+    }
+
+    for(int i = 0; i < Digest->Blocks.Index && !InOrder; i++) {
+        ui_block_digest *A = &Digest->Blocks.Items[i];
+        for(int j = i + 1; j < Digest->Blocks.Index; j++) {
+            ui_block_digest *B = &Digest->Blocks.Items[j];
+            if(A->Match > B->Match && B->Match >= 0) {
+                UI_AddDamage(Ctx, UI_IntersectRect(A->Bounds, B->Bounds));
+            }
+        }
+    }
 }
 
 void
@@ -157,57 +1417,254 @@ UI_End(ui_context *Ctx) {
         Ctx->PopUp.MarkedForDeath = 0;
     }
 
-    UI_SortCommandRefs(Ctx->CommandRefStack.Items, 0, Ctx->CommandRefStack.Index - 1);
+    UI_OrderCommandRefs(Ctx);
+    if(Ctx->CullOccluded) {
+        UI_CullOccludedBlocks(Ctx);
+    }
+    if(Ctx->TrackDamage) {
+        UI_TrackDamage(Ctx);
+    }
+    UI_BuildWindowGrid(Ctx);
+    UI_EvictStates(Ctx);
 }
 
 int
 UI_NextCommand(ui_context *Ctx, ui_command **Command) {
     for(; Ctx->CmdRefIndex < Ctx->CommandRefStack.Index; Ctx->CmdRefIndex++) {
-        ui_command_ref *Ref = &Ctx->CommandRefStack.Items[Ctx->CmdRefIndex];
-        int CmdCount = 1;
-        if(Ref->Target->Type == UI_COMMAND_BLOCK) {
-            CmdCount = Ref->Target->Command.Block.CommandCount;
-            /* The command at index 0 is of type UI_COMMNAD_BLOCK
-             * if the reference command points to a block, don't send it
-             * to the user. */
-            Ctx->CmdIndex += (Ctx->CmdIndex == 0);
-        }
-        if(Ctx->CmdIndex < CmdCount) {
-            ui_command *Cmd = Ref->Target + (Ctx->CmdIndex * Ref->Target->Command.Block.Direction);
-            *Command = Cmd;
-            Ctx->CmdIndex++;
+        unsigned char *Block = (unsigned char *)Ctx->CommandRefStack.Items[Ctx->CmdRefIndex].Target;
+        /* The block command itself is not sent to the user */
+        if(Ctx->CmdOffset == 0) {
+            Ctx->CmdOffset = sizeof(ui_command_block);
+        }
+        if(Ctx->CmdOffset < ((ui_command_block *)Block)->Size) {
+            *Command = (ui_command *)(Block + Ctx->CmdOffset);
+            Ctx->CmdOffset += (*Command)->Header.Size;
             return 1;
         }
-        Ctx->CmdIndex = 0;
+        Ctx->CmdOffset = 0;
     }
 
     return 0;
 }
 
+/* Returns the blocks in draw order, the commands of a block are iterated with
+ *     for(ui_command *Cmd = UI_BLOCK_BEGIN(Block); Cmd < UI_BLOCK_END(Block); Cmd = UI_NEXT_COMMAND(Cmd))
+ */
+int
+UI_NextBlock(ui_context *Ctx, ui_command_block **Block) {
+    if(Ctx->BlockRefIndex < Ctx->CommandRefStack.Index) {
+        *Block = Ctx->CommandRefStack.Items[Ctx->BlockRefIndex++].Target;
+        return 1;
+    }
+    return 0;
+}
+
 /* Text Buffering */
 
+/* Text is allocated from the chunk list starting at TextChunk. The chunks 
+ * after TextChunk have not been used this frame. */
 char *
-UI_PushNumberString(ui_context *Ctx, float Value) {
-    char *Dest = Ctx->TextBuffer + Ctx->TextBufferTop;
-    int BytesWritten = snprintf(Dest, UI_TEXT_MAX - Ctx->TextBufferTop, "%.02f", Value);
-    UI_ASSERT((Ctx->TextBufferTop + BytesWritten + 1) < UI_TEXT_MAX, "Text buffer exceeded");
+UI_PushText(ui_context *Ctx, size_t Size) {
+    ui_memory_chunk *Chunk = Ctx->TextChunk;
+    while(Chunk && Chunk->Size - Chunk->Used < Size) {
+        Chunk = Chunk->Next;
+        if(Chunk) {
+            Chunk->Used = 0;
+        }
+    }
+    if(!Chunk) {
+        /* Insert the new chunk after the current one so the unused chunks
+         * still follow it */
+        ui_memory_chunk **List = Ctx->TextChunk ? &Ctx->TextChunk->Next : &Ctx->TextChunks;
+        Chunk = UI_AllocateChunk(Ctx, List, UI_MAX(UI_TEXT_CHUNK_SIZE, Size));
+        if(!Chunk) {
+            return 0;
+        }
+    }
+    Ctx->TextChunk = Chunk;
+    char *Result = (char *)UI_CHUNK_DATA(Chunk) + Chunk->Used;
+    Chunk->Used += Size;
+    return Result;
+}
 
-    Ctx->TextBufferTop += BytesWritten + 1;
+char *
+UI_PushNumberString(ui_context *Ctx, float Value) {
+    /* Large enough for any float printed with %.02f */
+    size_t MaxLength = 64;
+    char *Dest = UI_PushText(Ctx, MaxLength);
+    if(!Dest) {
+        Ctx->DroppedTextCount++;
+        return "";
+    }
+    int BytesWritten = snprintf(Dest, MaxLength, "%.02f", Value);
+    Ctx->TextChunk->Used -= MaxLength - (BytesWritten + 1);
 
     return Dest; 
 }
 
-/* User input */
+/* Copies Str to the text of the frame, for strings that don't outlive the
+ * call */
+char *
+UI_PushString(ui_context *Ctx, char *Str) {
+    size_t Size = strlen(Str) + 1;
+    char *Dest = UI_PushText(Ctx, Size);
+    if(!Dest) {
+        Ctx->DroppedTextCount++;
+        return "";
+    }
+    memcpy(Dest, Str, Size);
+    return Dest;
+}
+
+void
+UI_SetGlyphAdvances(ui_context *Ctx, int *Advance) {
+    memcpy(Ctx->Glyphs.Advance, Advance, sizeof(Ctx->Glyphs.Advance));
+    Ctx->Glyphs.Monospace = 1;
+    for(int C = 1; C < 128; C++) {
+        if(Advance[C] != Advance[0]) {
+            Ctx->Glyphs.Monospace = 0;
+        }
+    }
+    Ctx->Glyphs.Valid = 1;
+}
+
+#define UI_HIGH_BITS 0x8080808080808080ull
 
 int
-UI_PointInsideRect(ui_rect Rect, ui_v2 P) {
-    if((P.x >= Rect.x && P.x <= (Rect.x + Rect.w)) &&
-       (P.y >= Rect.y && P.y <= (Rect.y + Rect.h))) {
-       return 1;
-   }
-    return 0;  
+UI_IsASCII(ui_str Text) {
+    unsigned char *At = (unsigned char *)Text.Data;
+    unsigned char *End = At + Text.Length;
+    unsigned long long Bits = 0;
+    for(; End - At >= 8; At += 8) {
+        unsigned long long Word;
+        memcpy(&Word, At, sizeof(Word));
+        Bits |= Word;
+    }
+    for(; At < End; At++) {
+        Bits |= *At;
+    }
+    return !(Bits & UI_HIGH_BITS);
 }
 
+/* Sums the advances of the glyph table eight bytes at a time, the high bits 
+ * of a word tell if all eight bytes are ASCII. Returns -1 if the text isn't
+ * ASCII and there's a callback to measure it. */
+int
+UI_SumAdvances(ui_context *Ctx, ui_str Text) {
+    int *Advance = Ctx->Glyphs.Advance;
+    int Callback = Ctx->MeasureText || Ctx->TextWidth;
+    if(Ctx->Glyphs.Monospace) {
+        return (!Callback || UI_IsASCII(Text)) ? Text.Length * Advance[0] : -1;
+    }
+
+    unsigned char *At = (unsigned char *)Text.Data;
+    unsigned char *End = At + Text.Length;
+    int Width = 0;
+    for(; End - At >= 8; At += 8) {
+        unsigned long long Word;
+        memcpy(&Word, At, sizeof(Word));
+        if(Word & UI_HIGH_BITS) {
+            break;
+        }
+        Width += Advance[At[0]] + Advance[At[1]] + Advance[At[2]] + Advance[At[3]] +
+                 Advance[At[4]] + Advance[At[5]] + Advance[At[6]] + Advance[At[7]];
+    }
+    for(; At < End; At++) {
+        if(*At < 128) {
+            Width += Advance[*At];
+        } else if(Callback) {
+            return -1;
+        } else {
+            Width += Advance['?'];
+        }
+    }
+    return Width;
+}
+
+void
+UI_FlushTextCache(ui_context *Ctx) {
+    if(Ctx->TextCache.Items) {
+        memset(Ctx->TextCache.Items, 0, UI_TEXT_CACHE_SIZE * sizeof(ui_text_width));
+    }
+}
+
+/* TextWidth needs a terminated string, Terminated is set if Text came in as
+ * a C string. Other text is copied to be terminated unless MeasureText is
+ * set. Returns -1 if there's no memory for the copy. */
+int
+UI_CallMeasureText(ui_context *Ctx, ui_str Text, int Terminated) {
+    if(Ctx->MeasureText) {
+        return Ctx->MeasureText(Text.Data, Text.Length);
+    }
+    if(Terminated) {
+        return Ctx->TextWidth(Text.Data);
+    }
+    char Buffer[256];
+    char *Copy = Buffer;
+    if(Text.Length >= (int)sizeof(Buffer)) {
+        Copy = UI_PushText(Ctx, Text.Length + 1);
+        if(!Copy) {
+            Ctx->DroppedTextCount++;
+            return -1;
+        }
+    }
+    memcpy(Copy, Text.Data, Text.Length);
+    Copy[Text.Length] = 0;
+    return Ctx->TextWidth(Copy);
+}
+
+/* Text is measured from the glyph advances if they're set, the callbacks are
+ * only called for widths that aren't in TextCache */
+int
+UI_MeasureText(ui_context *Ctx, ui_str Text, int Terminated) {
+    if(Ctx->Glyphs.Valid) {
+        int Width = UI_SumAdvances(Ctx, Text);
+        if(Width >= 0) {
+            return Width;
+        }
+    }
+
+    if(!Ctx->TextCache.Items) {
+        Ctx->TextCache.Items = UI_AllocateWindowMemory(Ctx, UI_TEXT_CACHE_SIZE * sizeof(ui_text_width));
+    }
+    if(Ctx->TextCache.TextWidth != Ctx->TextWidth || Ctx->TextCache.MeasureText != Ctx->MeasureText) {
+        UI_FlushTextCache(Ctx);
+        Ctx->TextCache.TextWidth = Ctx->TextWidth;
+        Ctx->TextCache.MeasureText = Ctx->MeasureText;
+    }
+
+    ui_id Hash = UI_HashStr(Text);
+    unsigned int Set = Hash & (UI_TEXT_CACHE_SIZE / UI_TEXT_CACHE_WAYS - 1);
+    ui_text_width *Items = Ctx->TextCache.Items + Set * UI_TEXT_CACHE_WAYS;
+    ui_text_width *Oldest = Items;
+    for(int i = 0; i < UI_TEXT_CACHE_WAYS; i++) {
+        if(Items[i].Frame && Items[i].Hash == Hash && Items[i].Length == Text.Length) {
+            Items[i].Frame = Ctx->Frame;
+            Ctx->TextCache.HitCount++;
+            return Items[i].Width;
+        }
+        if(Items[i].Frame < Oldest->Frame) {
+            Oldest = &Items[i];
+        }
+    }
+
+    Ctx->TextCache.MissCount++;
+    int Width = UI_CallMeasureText(Ctx, Text, Terminated);
+    if(Width < 0) {
+        return 0;
+    }
+    if(Oldest->Frame) {
+        Ctx->TextCache.EvictedCount++;
+    }
+    Oldest->Hash = Hash;
+    Oldest->Length = Text.Length;
+    Oldest->Width = Width;
+    Oldest->Frame = Ctx->Frame;
+    return Width;
+}
+
+/* User input */
+
 int
 UI_RectWasPressed(ui_context *Ctx, ui_rect Rect, int Button) {
     if(Ctx->MouseEvent.Active &&
@@ -219,22 +1676,37 @@ UI_RectWasPressed(ui_context *Ctx, ui_rect Rect, int Button) {
     return 0;
 }
 
+/* Links the window in at the top of the depth order, unlinking it first if
+ * it's already linked */
 void
-UI_FloatWindowToTop(ui_context *Ctx, int x, int y) {
-    for(int i = Ctx->WindowStack.Index - 1; i >= 0; i--) {
-        ui_window *Window = Ctx->WindowDepthOrder[i];
-        if(UI_PointInsideRect(Window->Rect, UI_V2(x, y))) {
-            if(Window->ZIndex < (Ctx->ZIndexTop - 1)) {
-                /* Update z-index for rendering */
-                Window->ZIndex = Ctx->ZIndexTop++;
-                /* Update depth stacking order for hit detection */
-                for(int j = i; j < Ctx->WindowStack.Index - 1; j++) {
-                    Ctx->WindowDepthOrder[j] = Ctx->WindowDepthOrder[j + 1];
-                }
-                Ctx->WindowDepthOrder[Ctx->WindowStack.Index - 1] = Window;
-            }
-            break;
-        }
+UI_RaiseWindow(ui_context *Ctx, ui_window *Window) {
+    if(Window == Ctx->WindowTop) {
+        return;
+    }
+    if(Window->Below) {
+        Window->Below->Above = Window->Above;
+    } else if(Window == Ctx->WindowBottom) {
+        Ctx->WindowBottom = Window->Above;
+    }
+    if(Window->Above) {
+        Window->Above->Below = Window->Below;
+    }
+    Window->Below = Ctx->WindowTop;
+    Window->Above = 0;
+    if(Ctx->WindowTop) {
+        Ctx->WindowTop->Above = Window;
+    } else {
+        Ctx->WindowBottom = Window;
+    }
+    Ctx->WindowTop = Window;
+    /* Update z-index for rendering */
+    Window->ZIndex = Ctx->ZIndexTop++;
+}
+
+void
+UI_FloatWindowToTop(ui_context *Ctx) {
+    if(Ctx->EventWindow) {
+        UI_RaiseWindow(Ctx, Ctx->EventWindow);
     }
 }
 
@@ -261,30 +1733,40 @@ UI_MouseButton(ui_context *Ctx, int x, int y, int Button, int EventType) {
     Ctx->MouseEvent.P = UI_V2(x, y);
     Ctx->MouseEvent.Button = Button;
     Ctx->MouseEvent.Type = EventType;
+    Ctx->EventWindow = UI_WindowAt(Ctx, Ctx->MouseEvent.P);
 
     if(EventType == UI_MOUSE_PRESSED) {
         if(Ctx->PopUp.ID && !UI_PointInsideRect(Ctx->PopUp.Rect, UI_V2(x, y))) {
             Ctx->PopUp.MarkedForDeath = 1;
-            UI_FloatWindowToTop(Ctx, x, y);
+            UI_FloatWindowToTop(Ctx);
         } else if(!Ctx->PopUp.ID) {
-            UI_FloatWindowToTop(Ctx, x, y);
+            UI_FloatWindowToTop(Ctx);
         }
     }
 }
 
+/* The mouse is over the window if it's the topmost window under the mouse in
+ * UI_Begin. A child region counts as over if its window is, the mouse can
+ * still be outside of the region. */
 int
 UI_OverWindow(ui_context *Ctx, ui_window *Window) {
-    for(int i = Ctx->WindowStack.Index - 1; i >= 0; i--) {
-        if(UI_PointInsideRect(Ctx->WindowDepthOrder[i]->Rect, Ctx->MousePos)) {
-            return (Ctx->WindowDepthOrder[i]->ID == Window->ID);
-        }
-    }
-    return 0;
+    return (Window && Ctx->HoverWindow == UI_RootWindow(Window));
 }
 
+/* Every widget tests its rect against the mouse. Looking the hot widget up
+ * in an index of the last frame's widget rects was slower than the test,
+ * see the hover benchmark in bench/. */
 int
 UI_UpdateInputState(ui_context *Ctx, ui_rect Rect, ui_id ID) {
     int Result = 0;
+    /* Widgets of a child region can only be hovered in the visible part of
+     * the region */
+    ui_rect HitRect = Rect;
+    int Hoverable = 1;
+    if(Ctx->WindowSelected && Ctx->WindowSelected->Parent) {
+        HitRect = UI_IntersectRect(Rect, Ctx->ClipStack.Items[Ctx->ClipStack.Index - 1]);
+        Hoverable = (HitRect.w > 0 && HitRect.h > 0);
+    }
 
     if(Ctx->Active == ID) {
         if(Ctx->MouseEvent.Active && Ctx->MouseEvent.Type == UI_MOUSE_RELEASED) {
@@ -293,7 +1775,7 @@ UI_UpdateInputState(ui_context *Ctx, ui_rect Rect, ui_id ID) {
                 Result = UI_INTERACTION_PRESS_AND_RELEASED;
             }
         }
-    } else if(Ctx->Hot == ID) {
+    } else if(Ctx->HotPrev == ID) {
         if(UI_RectWasPressed(Ctx, Rect, UI_MOUSE_LEFT)) {
             Ctx->Active = ID;
             Ctx->Hot = 0;
@@ -305,46 +1787,81 @@ UI_UpdateInputState(ui_context *Ctx, ui_rect Rect, ui_id ID) {
         if(Ctx->PopUp.ID && UI_PointInsideRect(Ctx->PopUp.Rect, Ctx->MousePos)) {
             Ctx->Hot = Ctx->PopUp.ID;
             Ctx->SomethingIsHot = 1;
-        } else if(UI_PointInsideRect(Rect, Ctx->MousePos) &&
-                  UI_OverWindow(Ctx, Ctx->WindowSelected)) {
+        } else if(Hoverable && UI_OverWindow(Ctx, Ctx->WindowSelected) &&
+                  UI_PointInsideRect(HitRect, Ctx->MousePos)) {
             Ctx->Hot = ID;
             Ctx->SomethingIsHot = 1;
         }
     }
 
+    if(Ctx->WindowSelected && (Ctx->Hot == ID || Ctx->Active == ID)) {
+        Ctx->WindowSelected->Interacted = 1;
+    }
+
     return Result;
 }
 
 /* Draw */
 
+/* Returns 0 if nothing of Rect is visible in the current clip rect, the 
+ * command should then not be emitted. When clip rects are resolved a 
+ * UI_COMMAND_CLIP is emitted if the command is clipped differently by the 
+ * current clip rect than by the clip rect of the previous command. */
+int
+UI_ClipCommand(ui_context *Ctx, ui_rect Rect) {
+    UI_ASSERT(Ctx->ActiveBlock, "Commands must be pushed between UI_Window and UI_EndWindow");
+    ui_rect Clip = Ctx->ClipStack.Items[Ctx->ClipStack.Index - 1];
+    ui_rect Visible = UI_IntersectRect(Rect, Clip);
+    if(Visible.w == 0 || Visible.h == 0) {
+        Ctx->CulledCommandCount++;
+        return 0;
+    }
+
+    ui_command_block *Block = Ctx->ActiveBlock;
+    Block->Bounds = UI_UnionRect(Block->Bounds, Visible);
+    if(Ctx->ResolveClip && !UI_RectEquals(UI_IntersectRect(Rect, Block->Clip), Visible)) {
+        ui_command_clip *Cmd = UI_PushCommand(Ctx, UI_COMMAND_CLIP, UI_COMMAND_SIZE(ui_command_clip));
+        Cmd->Rect = Clip;
+        Ctx->ActiveBlock->Clip = Clip;
+    }
+    return 1;
+}
+
 void
 UI_PushClipRect(ui_context *Ctx, ui_rect Rect) {
-    ui_command *Cmd = UI_PushCommand(Ctx);
-    Cmd->Type = UI_COMMAND_PUSH_CLIP;
-    Cmd->Command.Clip.Rect = Rect;
+    ui_rect *Top = UI_STACK_PUSH(Ctx->ClipStack, ui_rect);
+    *Top = UI_IntersectRect(Rect, Top[-1]);
+    if(!Ctx->ResolveClip) {
+        ui_command_clip *Cmd = UI_PushCommand(Ctx, UI_COMMAND_PUSH_CLIP, UI_COMMAND_SIZE(ui_command_clip));
+        Cmd->Rect = Rect;
+    }
 }
 
 void
 UI_PopClipRect(ui_context *Ctx) {
-    ui_command *Cmd = UI_PushCommand(Ctx);
-    Cmd->Type = UI_COMMAND_POP_CLIP;
+    Ctx->ClipStack.Index--;
+    if(!Ctx->ResolveClip) {
+        UI_PushCommand(Ctx, UI_COMMAND_POP_CLIP, UI_COMMAND_SIZE(ui_command_header));
+    }
 }
 
 void
 UI_DrawRect(ui_context *Ctx, ui_rect Rect, ui_color Color) {
-    ui_command *Cmd = UI_PushCommand(Ctx);
-    Cmd->Type = UI_COMMAND_RECT;
-    Cmd->Command.Rect.Rect = Rect;
-    Cmd->Command.Rect.Color = Color;
+    if(UI_ClipCommand(Ctx, Rect)) {
+        ui_command_rect *Cmd = UI_PushCommand(Ctx, UI_COMMAND_RECT, UI_COMMAND_SIZE(ui_command_rect));
+        Cmd->Rect = Rect;
+        Cmd->Color = Color;
+    }
 }
 
 void
 UI_DrawIcon(ui_context *Ctx, int ID, ui_rect Rect, ui_color Color) {
-    ui_command *Cmd = UI_PushCommand(Ctx);
-    Cmd->Type = UI_COMMAND_ICON;
-    Cmd->Command.Icon.Rect = Rect;
-    Cmd->Command.Icon.Color = Color;
-    Cmd->Command.Icon.ID = ID;
+    if(UI_ClipCommand(Ctx, Rect)) {
+        ui_command_icon *Cmd = UI_PushCommand(Ctx, UI_COMMAND_ICON, UI_COMMAND_SIZE(ui_command_icon));
+        Cmd->Rect = Rect;
+        Cmd->Color = Color;
+        Cmd->ID = ID;
+    }
 }
 
 /* All parameter of the passed rect is not necessarily used.
@@ -353,34 +1870,48 @@ UI_DrawIcon(ui_context *Ctx, int ID, ui_rect Rect, ui_color Color) {
  * UI_TEXT_OPT_CENTER : Rect (used, used, used, used)
  * UI_TEXT_OPT_VERT_CENTER : Rect (used, used, unused, used)
  * The rect returned is the bounding box of the text. */
+/* The text of the C string variants is terminated, see UI_MeasureText */
 ui_rect
-UI_DrawText(ui_context *Ctx, char *Text, ui_rect Rect, ui_color Color, int Options) {
+UI_DrawTextCore(ui_context *Ctx, ui_str Text, int Terminated, ui_rect Rect, ui_color Color, int Options) {
     ui_rect Result;
-    ui_command *Cmd = UI_PushCommand(Ctx);
-    Cmd->Type = UI_COMMAND_TEXT;
 
-    int TextWidth = Ctx->TextWidth(Text); 
+    int TextWidth = UI_MeasureText(Ctx, Text, Terminated);
     switch(Options) {
         case UI_TEXT_OPT_ORIGIN: {
-            Result = Cmd->Command.Text.Rect = UI_Rect(Rect.x, Rect.y, TextWidth, Ctx->TextHeight);
+            Result = UI_Rect(Rect.x, Rect.y, TextWidth, Ctx->TextHeight);
         } break;
         case UI_TEXT_OPT_CENTER: {
-            Result = Cmd->Command.Text.Rect = UI_Rect(Rect.x + (Rect.w - TextWidth) / 2,
-                                                      Rect.y + (Rect.h - Ctx->TextHeight) / 2,
-                                                      TextWidth, Ctx->TextHeight);
+            Result = UI_Rect(Rect.x + (Rect.w - TextWidth) / 2,
+                             Rect.y + (Rect.h - Ctx->TextHeight) / 2,
+                             TextWidth, Ctx->TextHeight);
         } break;
         case UI_TEXT_OPT_VERT_CENTER: {
-            Result = Cmd->Command.Text.Rect = UI_Rect(Rect.x, Rect.y + (Rect.h - Ctx->TextHeight) / 2,
-                                                      TextWidth, Ctx->TextHeight);
+            Result = UI_Rect(Rect.x, Rect.y + (Rect.h - Ctx->TextHeight) / 2,
+                             TextWidth, Ctx->TextHeight);
         } break;
         default: {
             UI_ABORT("Invalid text option");
         } break;
     }
 
-    Cmd->Command.Text.Color = Color;
-    Cmd->Command.Text.Text = Text;
-    return Result;
+    if(UI_ClipCommand(Ctx, Result)) {
+        ui_command_text *Cmd = UI_PushCommand(Ctx, UI_COMMAND_TEXT, UI_COMMAND_SIZE(ui_command_text));
+        Cmd->Rect = Result;
+        Cmd->Color = Color;
+        Cmd->Text = Text.Data;
+        Cmd->Length = Text.Length;
+    }
+    return Result;
+}
+
+ui_rect
+UI_DrawText(ui_context *Ctx, char *Text, ui_rect Rect, ui_color Color, int Options) {
+    return UI_DrawTextCore(Ctx, UI_CStr(Text), 1, Rect, Color, Options);
+}
+
+ui_rect
+UI_DrawTextStr(ui_context *Ctx, ui_str Text, ui_rect Rect, ui_color Color, int Options) {
+    return UI_DrawTextCore(Ctx, Text, 0, Rect, Color, Options);
 }
 
 /* Layout */
@@ -407,12 +1938,128 @@ UI_Inline(ui_context *Ctx) {
     Ctx->WindowSelected->Inline ^= 1;
 }
 
-ui_v2
-UI_AdvanceCursor(ui_window *Window, int x, int y) {
+/* Resolves the offsets of the columns from the left of the body. Fixed and
+ * auto columns take their width, fractional columns share what's left. */
+void
+UI_ResolveColumns(ui_columns *Columns, int BodyWidth) {
+    int Left = BodyWidth - (Columns->Count + 1) * UI_DEFAULT_PADDING;
+    float Fractions = 0;
+    for(int i = 0; i < Columns->Count; i++) {
+        ui_column *Spec = &Columns->Specs[i];
+        if(Spec->Type == UI_COLUMN_FIXED) {
+            Left -= (int)Spec->Size;
+        } else if(Spec->Type == UI_COLUMN_AUTO) {
+            Left -= Columns->Measured[i];
+        } else {
+            Fractions += Spec->Size;
+        }
+    }
+    Left = UI_MAX(Left, 0);
+
+    int x = 0;
+    for(int i = 0; i < Columns->Count; i++) {
+        ui_column *Spec = &Columns->Specs[i];
+        int Width = 0;
+        if(Spec->Type == UI_COLUMN_FIXED) {
+            Width = (int)Spec->Size;
+        } else if(Spec->Type == UI_COLUMN_AUTO) {
+            Width = Columns->Measured[i];
+        } else if(Fractions > 0) {
+            Width = (int)(Left * Spec->Size / Fractions);
+        }
+        Columns->Offsets[i] = x;
+        Columns->AutoWidths[i] = Columns->Measured[i];
+        x += Width + UI_DEFAULT_PADDING;
+    }
+    Columns->BodyWidth = BodyWidth;
+}
+
+/* Each call in a window takes the next layout of the window so layouts after
+ * each other keep their own offsets and widths. Measured still holds the
+ * widths of the last frame here, the offsets are only resolved again if they
+ * changed. */
+void
+UI_Columns(ui_context *Ctx, int Count, ui_column *Specs) {
+    ui_window *Window = Ctx->WindowSelected;
+    UI_ASSERT(!Window->Columns, "Column layouts can't be nested");
+    UI_ASSERT(Count > 0 && Count <= UI_COLUMN_MAX, "Too many columns");
+    if(Window->Layouts.Index == Window->Layouts.Capacity) {
+        unsigned int Capacity = UI_MAX(2, Window->Layouts.Capacity * 2);
+        ui_columns *Items = UI_AllocateWindowMemory(Ctx, Capacity * sizeof(ui_columns));
+        if(Window->Layouts.Items) {
+            memcpy(Items, Window->Layouts.Items, Window->Layouts.Capacity * sizeof(ui_columns));
+            UI_Deallocate(Ctx, Window->Layouts.Items, Window->Layouts.Capacity * sizeof(ui_columns));
+        }
+        Window->Layouts.Items = Items;
+        Window->Layouts.Capacity = Capacity;
+    }
+    ui_columns *Columns = &Window->Layouts.Items[Window->Layouts.Index++];
+
+    if(Window->Inline) {
+        UI_NextRow(Window);
+    }
+    Columns->Inline = Window->Inline;
+    Window->Inline = 0;
+
+    if(Count != Columns->Count || Window->Body.w != Columns->BodyWidth ||
+       memcmp(Specs, Columns->Specs, Count * sizeof(ui_column)) != 0 ||
+       memcmp(Columns->Measured, Columns->AutoWidths, Count * sizeof(int)) != 0) {
+        Columns->Count = Count;
+        memcpy(Columns->Specs, Specs, Count * sizeof(ui_column));
+        UI_ResolveColumns(Columns, Window->Body.w);
+    }
+    memset(Columns->Measured, 0, sizeof(Columns->Measured));
+    Columns->Column = 0;
+    Window->Columns = Columns;
+}
+
+void
+UI_EndColumns(ui_context *Ctx) {
+    ui_window *Window = Ctx->WindowSelected;
+    UI_ASSERT(Window->Columns, "UI_EndColumns must follow UI_Columns");
+    if(Window->Columns->Column > 0) {
+        UI_NextRow(Window);
+    }
+    Window->Inline = Window->Columns->Inline;
+    Window->Columns = 0;
+}
+
+/* Widgets only have to be measured before they are placed if their width 
+ * moves the cursor or sizes an auto column */
+int
+UI_NeedsWidth(ui_window *Window) {
+    ui_columns *Columns = Window->Columns;
+    if(Columns) {
+        int Column = (Columns->Column == Columns->Count) ? 0 : Columns->Column;
+        return (Columns->Specs[Column].Type == UI_COLUMN_AUTO);
+    }
+    return Window->Inline;
+}
+
+/* Places a widget of x by y at the cursor and writes its position to Dest.
+ * Returns 0 if the widget is scrolled out of the visible part of the body.
+ * The cursor is advanced either way so the height of the content stays
+ * exact, but the widget can skip measuring, formatting and drawing and only
+ * needs to update its input state if it's active. Only the width of inline
+ * widgets moves the cursor, in a column layout widgets go in the next cell
+ * and their width only sizes auto columns. */
+int
+UI_AdvanceCursor(ui_window *Window, int x, int y, ui_v2 *Dest) {
     ui_v2 Result;
+    ui_columns *Columns = Window->Columns;
+    if(Columns && Columns->Column == Columns->Count) {
+        UI_NextRow(Window);
+        Columns->Column = 0;
+    }
     Window->RowHeight = UI_MAX(y, Window->RowHeight);
 
-    if(Window->Inline) {
+    if(Columns) {
+        int Column = Columns->Column++;
+        Result = UI_V2(Window->Body.x + Columns->Offsets[Column], Window->Cursor.y - y);
+        if(Columns->Specs[Column].Type == UI_COLUMN_AUTO) {
+            Columns->Measured[Column] = UI_MAX(Columns->Measured[Column], x);
+        }
+    } else if(Window->Inline) {
         Result = UI_V2(Window->Cursor.x, Window->Cursor.y - y);
         Window->Cursor.x += x + UI_DEFAULT_PADDING;
     } else {
@@ -421,17 +2068,21 @@ UI_AdvanceCursor(ui_window *Window, int x, int y) {
 
     Result.x += UI_DEFAULT_PADDING;
     Result.y += Window->Body.y + Window->Body.h - UI_DEFAULT_PADDING + Window->Scroll;
+    *Dest = Result;
 
-    return Result;
+    return (Result.y <= Window->Visible.y + Window->Visible.h && Result.y + y >= Window->Visible.y);
 }
 
 /* Window */
 
+/* Linear probing, the index is at most half full so there's always an empty
+ * slot to stop at */
 ui_window *
 UI_FindWindow(ui_context *Ctx, ui_id ID) {
-    for(int i = 0; i < Ctx->WindowStack.Index; i++) {
-        ui_window *W = &Ctx->WindowStack.Items[i];
-        if(W->ID == ID) {
+    unsigned int Mask = Ctx->WindowIndex.Capacity - 1;
+    for(unsigned int i = ID & Mask; Ctx->WindowIndex.Capacity; i = (i + 1) & Mask) {
+        ui_window *W = Ctx->WindowIndex.Slots[i];
+        if(!W || W->ID == ID) {
             return W;
         }
     }
@@ -440,21 +2091,125 @@ UI_FindWindow(ui_context *Ctx, ui_id ID) {
 }
 
 void
-UI_Window(ui_context *Ctx, char *Name, int x, int y) {
-    ui_id ID = UI_Hash(Name, 0);
+UI_InsertWindowIndex(ui_context *Ctx, ui_window *Window) {
+    if(2 * (Ctx->WindowCount + 1) > Ctx->WindowIndex.Capacity) {
+        unsigned int OldCapacity = Ctx->WindowIndex.Capacity;
+        ui_window **OldSlots = Ctx->WindowIndex.Slots;
+        Ctx->WindowIndex.Capacity = UI_MAX(64, OldCapacity * 2);
+        Ctx->WindowIndex.Slots = UI_AllocateWindowMemory(Ctx, Ctx->WindowIndex.Capacity * sizeof(ui_window *));
+        for(unsigned int i = 0; i < OldCapacity; i++) {
+            if(OldSlots[i]) {
+                UI_InsertWindowIndex(Ctx, OldSlots[i]);
+            }
+        }
+        if(OldSlots) {
+            UI_Deallocate(Ctx, OldSlots, OldCapacity * sizeof(ui_window *));
+        }
+    }
+    unsigned int Mask = Ctx->WindowIndex.Capacity - 1;
+    unsigned int i = Window->ID & Mask;
+    while(Ctx->WindowIndex.Slots[i]) {
+        i = (i + 1) & Mask;
+    }
+    Ctx->WindowIndex.Slots[i] = Window;
+}
+
+/* The window isn't linked into the depth order, child regions never are */
+ui_window *
+UI_CreateWindow(ui_context *Ctx, ui_id ID) {
+    ui_window_page *Page = Ctx->WindowPages;
+    if(!Page || Page->Count == UI_WINDOW_PAGE_SIZE) {
+        Page = UI_AllocateWindowMemory(Ctx, sizeof(ui_window_page));
+        Page->Next = Ctx->WindowPages;
+        Ctx->WindowPages = Page;
+    }
+    ui_window *Window = &Page->Items[Page->Count++];
+    Window->ID = ID;
+    UI_InsertWindowIndex(Ctx, Window);
+    Ctx->WindowCount++;
+    return Window;
+}
+
+ui_rect
+UI_WindowBorder(ui_window *Window) {
+    return UI_Rect(Window->Rect.x - UI_WINDOW_BORDER, 
+                   Window->Rect.y - UI_WINDOW_BORDER,
+                   Window->Rect.w + 2 * UI_WINDOW_BORDER, 
+                   Window->Rect.h + 2 * UI_WINDOW_BORDER);
+}
+
+/* The body of a window is hidden if the window is collapsed, outside of the
+ * viewport or inside the border of a window in front of it. Only windows that
+ * were already built this frame count, the others may still move or not be
+ * built at all, so the window is reported visible. */
+int
+UI_WindowIsHidden(ui_context *Ctx, ui_window *Window) {
+    ui_rect Border = UI_WindowBorder(Window);
+    if(Window->Collapsed) {
+        return 1;
+    }
+    if(Ctx->Viewport.w > 0 && Ctx->Viewport.h > 0 && !UI_RectsOverlap(Border, Ctx->Viewport)) {
+        return 1;
+    }
+    if(UI_COLOR3.a != 0xff) {
+        return 0;
+    }
+    if(Ctx->WindowGrid.Valid) {
+        /* A window whose border contains the border is listed in the cell of
+         * its center, unless it moved since the grid was built last frame */
+        ui_v2 Center = UI_RectCenter(Border);
+        int Cell = UI_WindowGridCell(Ctx, Center.x, Center.y);
+        for(unsigned int i = Ctx->WindowGrid.CellStart[Cell]; i < Ctx->WindowGrid.CellStart[Cell + 1]; i++) {
+            ui_window *Other = Ctx->WindowGrid.Items[i];
+            if(Other->Frame == Ctx->Frame && Other->ZIndex > Window->ZIndex &&
+               UI_RectContains(UI_WindowBorder(Other), Border)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    for(ui_window *Other = Window->Above; Other; Other = Other->Above) {
+        if(Other->Frame == Ctx->Frame && UI_RectContains(UI_WindowBorder(Other), Border)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void
+UI_ToggleCollapsed(ui_window *Window) {
+    if(Window->Collapsed) {
+        Window->Rect.h = Window->ExpandedHeight;
+        Window->Rect.y = Window->Title.y + Window->Title.h - Window->Rect.h;
+        Window->Body = UI_Rect(Window->Rect.x, Window->Rect.y, Window->Rect.w, Window->Rect.h - Window->Title.h);
+    } else {
+        Window->ExpandedHeight = Window->Rect.h;
+        Window->Rect = Window->Title;
+        Window->Body = UI_Rect(Window->Title.x, Window->Title.y, Window->Title.w, 0);
+    }
+    Window->Collapsed = !Window->Collapsed;
+}
+
+/* Returns 0 if the body of the window is hidden and the widgets in it don't
+ * need to be built. UI_EndWindow must be called either way. */
+int
+UI_WindowID(ui_context *Ctx, ui_id ID, char *Name, int x, int y) {
     ui_window *Window = UI_FindWindow(Ctx, ID);
     if(!Window) {
-        Window = UI_STACK_PUSH(Ctx->WindowStack, ui_window);
-        Window->ID = ID;
+        /* New windows are created on top */
+        Window = UI_CreateWindow(Ctx, ID);
+        UI_RaiseWindow(Ctx, Window);
         Window->Rect = UI_Rect(x, y - UI_WINDOW_MIN_HEIGHT, UI_WINDOW_MIN_WIDTH, UI_WINDOW_MIN_HEIGHT);
         Window->Title = UI_Rect(x, y - UI_WINDOW_TITLE_BAR_HEIGHT, Window->Rect.w, UI_WINDOW_TITLE_BAR_HEIGHT);
         Window->Body = UI_Rect(x, y - Window->Rect.h, Window->Rect.w, Window->Rect.h - Window->Title.h);
-
-        Window->ZIndex = Ctx->ZIndexTop++;
-        Ctx->WindowDepthOrder[Ctx->WindowStack.Index - 1] = Window;
     }
     Ctx->WindowSelected = Window;
     Window->Cursor = UI_V2(0, 0);
+    Window->Columns = 0;
+    Window->Layouts.Index = 0;
+    Window->Interacted = 0;
+    Window->Caching = 0;
+    Window->Replayed = 0;
 
     ui_rect ResizeNotch = 
         UI_Rect(Window->Rect.x + Window->Rect.w - UI_WINDOW_RESIZE_ICON_SIZE,
@@ -462,8 +2217,10 @@ UI_Window(ui_context *Ctx, char *Name, int x, int y) {
                 UI_WINDOW_RESIZE_ICON_SIZE, 
                 UI_WINDOW_RESIZE_ICON_SIZE);
 
-    ui_id NotchID = UI_Hash("resize_notch", Window->ID);
-    UI_UpdateInputState(Ctx, ResizeNotch, NotchID);
+    ui_id NotchID = UI_HashCombine(Window->ID, UI_ID("resize_notch"));
+    if(!Window->Collapsed) {
+        UI_UpdateInputState(Ctx, ResizeNotch, NotchID);
+    }
     if(NotchID == Ctx->Active) {
         ui_v2 ControlPoint = UI_V2(ResizeNotch.x + ResizeNotch.w, ResizeNotch.y);
 
@@ -482,7 +2239,12 @@ UI_Window(ui_context *Ctx, char *Name, int x, int y) {
         ResizeNotch.y -= dH;
     }
 
-    UI_UpdateInputState(Ctx, Window->Title, ID);
+    /* The title bar is grabbed to the left of the collapse button so they
+     * never overlap */
+    ui_rect Grab = UI_Rect(Window->Title.x, Window->Title.y, 
+                           Window->Title.w - UI_WINDOW_RESIZE_ICON_SIZE - UI_DEFAULT_PADDING, 
+                           Window->Title.h);
+    UI_UpdateInputState(Ctx, Grab, ID);
     if(ID == Ctx->Active) {
         int dX = Ctx->MousePos.x - Ctx->MousePosPrev.x;
         int dY = Ctx->MousePos.y - Ctx->MousePosPrev.y;
@@ -496,23 +2258,26 @@ UI_Window(ui_context *Ctx, char *Name, int x, int y) {
         ResizeNotch.y += dY;
     }
 
+    ui_rect CollapseButton = 
+        UI_Rect(Window->Title.x + Window->Title.w - UI_WINDOW_RESIZE_ICON_SIZE - UI_DEFAULT_PADDING,
+                Window->Title.y + (Window->Title.h - UI_WINDOW_RESIZE_ICON_SIZE) / 2,
+                UI_WINDOW_RESIZE_ICON_SIZE,
+                UI_WINDOW_RESIZE_ICON_SIZE);
+    ui_id CollapseID = UI_HashCombine(Window->ID, UI_ID("collapse"));
+    if(UI_UpdateInputState(Ctx, CollapseButton, CollapseID) == UI_INTERACTION_PRESS_AND_RELEASED) {
+        UI_ToggleCollapsed(Window);
+    }
+
     /* TODO: Support creating windows while creating another window */
     UI_ASSERT(!Ctx->ActiveBlock, "Can't recursively create command blocks");
-    ui_command *Cmd = UI_STACK_PUSH(Ctx->CommandStack, ui_command);
-    Cmd->Type = UI_COMMAND_BLOCK;
-    Cmd->Command.Block.ZIndex = Window->ZIndex;
-    Cmd->Command.Block.Direction = 1;
-    Ctx->ActiveBlock = &Cmd->Command.Block;
-
-    ui_command_ref *CmdRef = UI_STACK_PUSH(Ctx->CommandRefStack, ui_command_ref);
-    CmdRef->Target = Cmd;
-    CmdRef->SortKey = Window->ZIndex;
-
-    UI_DrawRect(Ctx, UI_Rect(Window->Rect.x - UI_WINDOW_BORDER, 
-                             Window->Rect.y - UI_WINDOW_BORDER,
-                             Window->Rect.w + 2 * UI_WINDOW_BORDER, 
-                             Window->Rect.h + 2 * UI_WINDOW_BORDER),
-                UI_COLOR3);
+    Window->Frame = Ctx->Frame;
+    Window->BlockRef = UI_BeginBlock(Ctx, Window->ID, Window->ZIndex);
+
+    ui_rect Border = UI_WindowBorder(Window);
+    UI_DrawRect(Ctx, Border, UI_COLOR3);
+    if(UI_COLOR3.a == 0xff) {
+        Ctx->ActiveBlock->Opaque = Border;
+    }
     UI_DrawRect(Ctx, Window->Body, UI_COLOR0);
 
     UI_PushClipRect(Ctx, Window->Title);
@@ -522,22 +2287,147 @@ UI_Window(ui_context *Ctx, char *Name, int x, int y) {
                 UI_COLOR_TEXT, UI_TEXT_OPT_VERT_CENTER);
     UI_PopClipRect(Ctx);
     
-    UI_DrawIcon(Ctx, UI_ICON_RESIZE, ResizeNotch, UI_COLOR4);
+    UI_DrawIcon(Ctx, Window->Collapsed ? UI_ICON_EXPAND : UI_ICON_COLLAPSE, CollapseButton,
+                (Ctx->Hot == CollapseID) ? UI_COLOR_HIGHLIGHT : UI_COLOR4);
+    if(!Window->Collapsed) {
+        UI_DrawIcon(Ctx, UI_ICON_RESIZE, ResizeNotch, UI_COLOR4);
+    }
     UI_PushClipRect(Ctx, Window->Body);
+    Window->Visible = Window->Body;
+    Window->BodyOffset = Ctx->ActiveBlock->Size;
+
+    Window->BodySkipped = UI_WindowIsHidden(Ctx, Window);
+    return !Window->BodySkipped;
 }
 
+/* Copies the body commands of the active block and their text to the 
+ * window's cache */
 void
-UI_EndWindow(ui_context *Ctx) {
+UI_StoreWindowCache(ui_context *Ctx, ui_window *Window) {
+    ui_command_block *Block = Ctx->ActiveBlock;
+    ui_window_cache *Cache = &Window->Cache;
+    Cache->Valid = 0;
+    if(Block->Dropped) {
+        return;
+    }
+
+    ui_command *Begin = (ui_command *)((unsigned char *)Block + Window->BodyOffset);
+    size_t CommandSize = Block->Size - Window->BodyOffset;
+    size_t Size = CommandSize;
+    for(ui_command *Cmd = Begin; Cmd < UI_BLOCK_END(Block); Cmd = UI_NEXT_COMMAND(Cmd)) {
+        if(Cmd->Type == UI_COMMAND_TEXT) {
+            Size += Cmd->Text.Length + 1;
+        }
+    }
+    if(Cache->Capacity < Size) {
+        unsigned char *Memory = UI_Allocate(Ctx, 2 * Size);
+        if(!Memory) {
+            return;
+        }
+        if(Cache->Memory) {
+            UI_Deallocate(Ctx, Cache->Memory, Cache->Capacity);
+        }
+        Cache->Memory = Memory;
+        Cache->Capacity = 2 * Size;
+    }
+
+    if(CommandSize) {
+        memcpy(Cache->Memory, Begin, CommandSize);
+    }
+    unsigned char *Text = Cache->Memory + CommandSize;
+    memset(Cache->TypeCount, 0, sizeof(Cache->TypeCount));
+    Cache->CommandCount = 0;
+    for(ui_command *Cmd = (ui_command *)Cache->Memory; (unsigned char *)Cmd < Cache->Memory + CommandSize; Cmd = UI_NEXT_COMMAND(Cmd)) {
+        if(Cmd->Type == UI_COMMAND_TEXT) {
+            memcpy(Text, Cmd->Text.Text, Cmd->Text.Length);
+            Text[Cmd->Text.Length] = 0;
+            Cmd->Text.Text = (char *)Text;
+            Text += Cmd->Text.Length + 1;
+        }
+        Cache->CommandCount++;
+        Cache->TypeCount[Cmd->Type]++;
+    }
+
+    Cache->CommandSize = CommandSize;
+    Cache->Bounds = Block->Bounds;
+    Cache->Clip = Block->Clip;
+    Cache->Rect = Window->Rect;
+    Cache->Body = Window->Body;
+    Cache->Viewport = Ctx->Viewport;
+    Cache->Scroll = Window->Scroll;
+    Cache->ResolveClip = Ctx->ResolveClip;
+    /* The scroll bar is only drawn while the mouse is over the window */
+    Cache->Interacted = Window->Interacted || UI_OverWindow(Ctx, Window);
+    Cache->Valid = 1;
+}
+
+/* Appends the cached body commands to the active block */
+void
+UI_ReplayWindowCache(ui_context *Ctx, ui_window *Window) {
+    ui_window_cache *Cache = &Window->Cache;
+    ui_command_block *Block = Ctx->ActiveBlock;
+    Window->Replayed = 1;
+    if(Block->Dropped || Block->Chunk->Size - Block->Chunk->Used < Cache->CommandSize) {
+        if(!UI_ReserveCommandSpace(Ctx, Cache->CommandSize)) {
+            Ctx->DroppedCommandCount += Cache->CommandCount;
+            return;
+        }
+        Block = Ctx->ActiveBlock;
+    }
+    if(Cache->CommandSize) {
+        memcpy(UI_CHUNK_DATA(Block->Chunk) + Block->Chunk->Used, Cache->Memory, Cache->CommandSize);
+    }
+    Block->Chunk->Used += Cache->CommandSize;
+    Block->Size += Cache->CommandSize;
+    Block->CommandCount += Cache->CommandCount;
+    for(int i = 0; i < UI_COMMAND_TYPE_COUNT; i++) {
+        Block->TypeCount[i] += Cache->TypeCount[i];
+    }
+    Block->Bounds = UI_UnionRect(Block->Bounds, Cache->Bounds);
+    Block->Clip = Cache->Clip;
+}
+
+int
+UI_Window(ui_context *Ctx, char *Name, int x, int y) {
+    return UI_WindowID(Ctx, UI_HashString(Name), Name, x, y);
+}
+
+/* Like UI_Window, but the body is only built when Version or the window
+ * changed since the last build, or the mouse is over the window or a widget
+ * in it was interacted with. Otherwise the commands of the last build are
+ * replayed and 0 is returned. UI_EndWindow must be called either way. */
+int
+UI_CachedWindow(ui_context *Ctx, char *Name, int x, int y, unsigned int Version) {
+    if(!UI_Window(Ctx, Name, x, y)) {
+        return 0;
+    }
     ui_window *Window = Ctx->WindowSelected;
+    ui_window_cache *Cache = &Window->Cache;
+    if(Cache->Valid && Cache->Version == Version && 
+       !Cache->Interacted && !Window->Interacted &&
+       UI_RectEquals(Cache->Rect, Window->Rect) && UI_RectEquals(Cache->Body, Window->Body) &&
+       Cache->Scroll == Window->Scroll && UI_RectEquals(Cache->Viewport, Ctx->Viewport) &&
+       Cache->ResolveClip == Ctx->ResolveClip && !UI_OverWindow(Ctx, Window) &&
+       !(Ctx->MouseEvent.Active && Ctx->EventWindow == Window)) {
+        UI_ReplayWindowCache(Ctx, Window);
+        Window->BodySkipped = 1;
+        Ctx->ReplayHitCount++;
+        return 0;
+    }
+    Ctx->ReplayMissCount++;
+    Window->Caching = 1;
+    Cache->Version = Version;
+    return 1;
+}
+
+/* The scroll bar of a window or child region in Track, shown while the mouse
+ * is Over the body and the content doesn't fit or while it's dragged. The
+ * wheel is consumed when the mouse is over the body. */
+void
+UI_ScrollBar(ui_context *Ctx, ui_window *Window, ui_rect Track, int Over) {
     int HeightOfContent = -Window->Cursor.y;
-    ui_id ScrollID = UI_Hash("scroll_bar", Window->ID);
-    if(HeightOfContent > Window->Body.h && 
-       (UI_OverWindow(Ctx, Window) || Ctx->Active == ScrollID)) {
-        int Width = 8;
-        ui_rect Track = UI_Rect(Window->Body.x + Window->Body.w - Width,
-                                Window->Body.y + UI_WINDOW_RESIZE_ICON_SIZE, 
-                                Width, 
-                                Window->Body.h - UI_WINDOW_RESIZE_ICON_SIZE);
+    ui_id ScrollID = UI_HashCombine(Window->ID, UI_ID("scroll_bar"));
+    if(HeightOfContent > Window->Body.h && (Over || Ctx->Active == ScrollID)) {
         ui_rect Slider = UI_Rect(Track.x, Track.y,
                                  Track.w,
                                  (int)(Track.h * (float)Window->Body.h / HeightOfContent));
@@ -549,8 +2439,9 @@ UI_EndWindow(ui_context *Ctx) {
             int dY = Ctx->MousePosPrev.y - Ctx->MousePos.y;
             Window->Scroll += (float)dY / (Track.h - Slider.h) * ScrollRange;
         } 
-        if(UI_OverWindow(Ctx, Window)) {
+        if(Over) {
             Window->Scroll += Ctx->MouseScroll * 10;
+            Ctx->MouseScroll = 0;
         }
         Window->Scroll = UI_Clamp(Window->Scroll, 0, ScrollRange);
 
@@ -560,53 +2451,63 @@ UI_EndWindow(ui_context *Ctx) {
         UI_DrawRect(Ctx, Track, UI_COLOR1);
         UI_DrawRect(Ctx, Slider, UI_COLOR4);
     }
+}
+
+void
+UI_EndWindow(ui_context *Ctx) {
+    ui_window *Window = Ctx->WindowSelected;
+    if(!Window->Replayed) {
+        int Width = 8;
+        ui_rect Track = UI_Rect(Window->Body.x + Window->Body.w - Width,
+                                Window->Body.y + UI_WINDOW_RESIZE_ICON_SIZE, 
+                                Width, 
+                                Window->Body.h - UI_WINDOW_RESIZE_ICON_SIZE);
+        UI_ScrollBar(Ctx, Window, Track, UI_OverWindow(Ctx, Window));
+    }
     
+    if(Window->Caching) {
+        UI_StoreWindowCache(Ctx, Window);
+    }
+
     Ctx->WindowSelected = 0;
     UI_PopClipRect(Ctx);
 
     /* TODO: Again, this does not work with command blocks inside other command
      * blocks */
-    ui_command *End = (Ctx->CommandStack.Items + Ctx->CommandStack.Index);
-    ui_command *Start = UI_REBASE(Ctx->ActiveBlock, ui_command, Command.Block);
-    Ctx->ActiveBlock->CommandCount = End - Start;
-    Ctx->ActiveBlock = 0;
+    UI_EndBlock(Ctx);
 }
 
 /* Widgets */
 
 void
 UI_BeginPopUp(ui_context *Ctx) {
+    if(Ctx->WindowSelected) {
+        Ctx->WindowSelected->Interacted = 1;
+    }
     Ctx->PausedBlock = Ctx->ActiveBlock;
-    ui_command *Cmd = UI_PushCommandEx(Ctx, -1);
-    Cmd->Type = UI_COMMAND_BLOCK;
-    Cmd->Command.Block.ZIndex = UI_INT_MAX;
-    Cmd->Command.Block.Direction = -1;
-    Ctx->ActiveBlock = &Cmd->Command.Block;
-
-    ui_command_ref *CmdRef = UI_STACK_PUSH(Ctx->CommandRefStack, ui_command_ref);
-    CmdRef->Target = Cmd;
-    CmdRef->SortKey = UI_INT_MAX;
+    UI_BeginBlock(Ctx, Ctx->PopUp.ID, UI_INT_MAX);
 }
 
 void
 UI_EndPopUp(ui_context *Ctx) {
-    ui_command *End = Ctx->CommandStack.Items + Ctx->CommandStack.Index2;
-    ui_command *Start = UI_REBASE(Ctx->ActiveBlock, ui_command, Command.Block);
-    Ctx->ActiveBlock->CommandCount = Start - End; /* Direction is -1 */
-    Ctx->ActiveBlock = Ctx->PausedBlock;
+    UI_EndBlock(Ctx);
 }
 
 int
-UI_Number(ui_context *Ctx, char *Name, float Step, float *Value) {
+UI_NumberID(ui_context *Ctx, ui_id ID, float Step, float *Value) {
     float OldValue = *Value;
 
-    ui_id ID = UI_Hash(Name, 0);
-
     int ButtonWidth = Ctx->TextHeight + 4;
     int ButtonHeight = ButtonWidth;
-    int NumberFieldWidth = Ctx->TextWidth("0") * 10;
+    int NumberFieldWidth = UI_MeasureText(Ctx, UI_Str("0", 1), 1) * 10;
     int ContainerWidth = ButtonWidth * 2 + NumberFieldWidth; 
-    ui_v2 Dest = UI_AdvanceCursor(Ctx->WindowSelected, ContainerWidth, ButtonHeight);
+    ui_id IncID = UI_HashCombine(ID, UI_ID("inc_button"));
+    ui_id DecID = UI_HashCombine(ID, UI_ID("dec_button"));
+    ui_v2 Dest;
+    if(!UI_AdvanceCursor(Ctx->WindowSelected, ContainerWidth, ButtonHeight, &Dest) &&
+       Ctx->Active != IncID && Ctx->Active != DecID) {
+        return 0;
+    }
     ui_rect ContainerRect = UI_Rect(Dest.x, Dest.y, ContainerWidth, ButtonHeight);
 
     int x = ContainerRect.x;
@@ -616,9 +2517,9 @@ UI_Number(ui_context *Ctx, char *Name, float Step, float *Value) {
     x += NumberFieldRect.w;
     ui_rect IncRect = UI_Rect(x, ContainerRect.y, ButtonWidth, ContainerRect.h);
 
-    if(UI_UpdateInputState(Ctx, IncRect, UI_Hash("inc_button", ID)) == UI_INTERACTION_PRESS) {
+    if(UI_UpdateInputState(Ctx, IncRect, IncID) == UI_INTERACTION_PRESS) {
         *Value += Step;
-    } else if(UI_UpdateInputState(Ctx, DecRect, UI_Hash("dec_button", ID)) == UI_INTERACTION_PRESS) {
+    } else if(UI_UpdateInputState(Ctx, DecRect, DecID) == UI_INTERACTION_PRESS) {
         *Value -= Step;
     }
 
@@ -633,15 +2534,22 @@ UI_Number(ui_context *Ctx, char *Name, float Step, float *Value) {
 }
 
 int
-UI_Slider(ui_context *Ctx, char *Name, float Low, float High, float *Value) {
+UI_Number(ui_context *Ctx, char *Name, float Step, float *Value) {
+    return UI_NumberID(Ctx, UI_HashString(Name), Step, Value);
+}
+
+int
+UI_SliderID(ui_context *Ctx, ui_id ID, float Low, float High, float *Value) {
     float OldValue = *Value;
 
-    int SliderTrackWidth = Ctx->TextWidth("0") * 15;
+    int SliderTrackWidth = UI_MeasureText(Ctx, UI_Str("0", 1), 1) * 15;
     int SliderTrackHeight = Ctx->TextHeight + 4;
-    ui_v2 Dest = UI_AdvanceCursor(Ctx->WindowSelected, SliderTrackWidth, SliderTrackHeight);
+    ui_v2 Dest;
+    if(!UI_AdvanceCursor(Ctx->WindowSelected, SliderTrackWidth, SliderTrackHeight, &Dest) && Ctx->Active != ID) {
+        return 0;
+    }
     ui_rect SliderTrackRect = UI_Rect(Dest.x, Dest.y, SliderTrackWidth, SliderTrackHeight);
 
-    ui_id ID = UI_Hash(Name, 0);
     UI_UpdateInputState(Ctx, SliderTrackRect, ID);
 
     *Value = UI_Clamp(*Value, Low, High);
@@ -671,18 +2579,29 @@ UI_Slider(ui_context *Ctx, char *Name, float Low, float High, float *Value) {
 }
 
 int
-UI_CheckBox(ui_context *Ctx, char *Label, int DrawLabel, int *ValueOut) {
+UI_Slider(ui_context *Ctx, char *Name, float Low, float High, float *Value) {
+    return UI_SliderID(Ctx, UI_HashString(Name), Low, High, Value);
+}
+
+int
+UI_CheckBoxID(ui_context *Ctx, ui_id ID, char *Label, int DrawLabel, int *ValueOut) {
     int OldValue = *ValueOut;
-    ui_id ID = UI_Hash(Label, 0);
+    ui_window *Window = Ctx->WindowSelected;
     int Height = Ctx->TextHeight + 2;
-    int Width = Height;
-    int TextWidth;
-    if(DrawLabel) {
-        TextWidth = Ctx->TextWidth(Label);
-        Width += UI_DEFAULT_PADDING + TextWidth;
+    /* The label is measured before placing the widget only if the layout
+     * needs its width */
+    int Measured = (DrawLabel && UI_NeedsWidth(Window));
+    int TextWidth = Measured ? UI_MeasureText(Ctx, UI_CStr(Label), 1) : 0;
+    int Width = Height + (DrawLabel ? UI_DEFAULT_PADDING + TextWidth : 0);
+
+    ui_v2 Dest;
+    if(!UI_AdvanceCursor(Window, Width, Height, &Dest) && Ctx->Active != ID) {
+        return 0;
+    }
+    if(DrawLabel && !Measured) {
+        TextWidth = UI_MeasureText(Ctx, UI_CStr(Label), 1);
+        Width += TextWidth;
     }
-
-    ui_v2 Dest = UI_AdvanceCursor(Ctx->WindowSelected, Width, Height);
 
     ui_rect Clickable = UI_Rect(Dest.x, Dest.y, Width, Height);
     int Interaction = UI_UpdateInputState(Ctx, Clickable, ID);
@@ -710,11 +2629,20 @@ UI_CheckBox(ui_context *Ctx, char *Label, int DrawLabel, int *ValueOut) {
 }
 
 int
-UI_Button(ui_context *Ctx, char *Label) {
-    ui_id ID = UI_Hash(Label, Ctx->WindowSelected->ID);
+UI_CheckBox(ui_context *Ctx, char *Label, int DrawLabel, int *ValueOut) {
+    return UI_CheckBoxID(Ctx, UI_HashString(Label), Label, DrawLabel, ValueOut);
+}
+
+/* LabelID is combined with the ID of the window, like the ID of a dropdown */
+int
+UI_ButtonCore(ui_context *Ctx, ui_id LabelID, ui_str Label, int Terminated) {
+    ui_id ID = UI_HashCombine(Ctx->WindowSelected->ID, LabelID);
 
     int ButtonHeight = Ctx->TextHeight + 2;
-    ui_v2 Dest = UI_AdvanceCursor(Ctx->WindowSelected, UI_BUTTON_WIDTH, ButtonHeight);
+    ui_v2 Dest;
+    if(!UI_AdvanceCursor(Ctx->WindowSelected, UI_BUTTON_WIDTH, ButtonHeight, &Dest) && Ctx->Active != ID) {
+        return 0;
+    }
 
     ui_rect BorderRect = UI_Rect(Dest.x, Dest.y, UI_BUTTON_WIDTH, ButtonHeight);
     ui_rect InnerRect = UI_Rect(BorderRect.x + 1, BorderRect.y + 1, BorderRect.w - 2, BorderRect.h - 2);
@@ -730,26 +2658,68 @@ UI_Button(ui_context *Ctx, char *Label) {
 
     UI_DrawRect(Ctx, BorderRect, UI_COLOR2);
     UI_DrawRect(Ctx, InnerRect, Color);
-    UI_DrawText(Ctx, Label, BorderRect, UI_COLOR_TEXT, UI_TEXT_OPT_CENTER);
+    UI_DrawTextCore(Ctx, Label, Terminated, BorderRect, UI_COLOR_TEXT, UI_TEXT_OPT_CENTER);
 
     return Interaction;
 }
 
+int
+UI_ButtonID(ui_context *Ctx, ui_id LabelID, char *Label) {
+    return UI_ButtonCore(Ctx, LabelID, UI_CStr(Label), 1);
+}
+
+int
+UI_ButtonStrID(ui_context *Ctx, ui_id LabelID, ui_str Label) {
+    return UI_ButtonCore(Ctx, LabelID, Label, 0);
+}
+
+int
+UI_Button(ui_context *Ctx, char *Label) {
+    ui_str Str = UI_CStr(Label);
+    return UI_ButtonCore(Ctx, UI_HashStr(Str), Str, 1);
+}
+
+int
+UI_ButtonStr(ui_context *Ctx, ui_str Label) {
+    return UI_ButtonStrID(Ctx, UI_HashStr(Label), Label);
+}
+
+void
+UI_TextCore(ui_context *Ctx, ui_str Text, int Terminated, ui_color Color) {
+    ui_window *Window = Ctx->WindowSelected;
+    ui_v2 Dest;
+    if(UI_AdvanceCursor(Window, UI_NeedsWidth(Window) ? UI_MeasureText(Ctx, Text, Terminated) : 0, Ctx->TextHeight, &Dest)) {
+        UI_DrawTextCore(Ctx, Text, Terminated, UI_Rect(Dest.x, Dest.y, 0, 0), Color, UI_TEXT_OPT_ORIGIN);
+    }
+}
+
 void
 UI_Text(ui_context *Ctx, char *Text, ui_color Color) {
-    ui_v2 Dest = UI_AdvanceCursor(Ctx->WindowSelected, Ctx->TextWidth(Text), Ctx->TextHeight);
-    UI_DrawText(Ctx, Text, UI_Rect(Dest.x, Dest.y, 0, 0), Color, UI_TEXT_OPT_ORIGIN);
+    UI_TextCore(Ctx, UI_CStr(Text), 1, Color);
+}
+
+void
+UI_TextStr(ui_context *Ctx, ui_str Text, ui_color Color) {
+    UI_TextCore(Ctx, Text, 0, Color);
 }
 
+/* An open menu only draws the items in its visible part. The text of the
+ * items is copied if it comes from a getter, the strings of an array stay
+ * valid like any other text passed to a widget. */
 int
-UI_Dropdown(ui_context *Ctx, char *Name, char **Items, unsigned int ItemCount, unsigned int Stride, int *IndexOut) {
+UI_DropdownCore(ui_context *Ctx, ui_id NameID, ui_get_item GetItem, void *User, unsigned int ItemCount, int *IndexOut,
+                int CopyItems) {
     int Result = 0;
-    ui_id ID = UI_Hash(Name, Ctx->WindowSelected->ID);
-    ui_id MenuID = UI_Hash("dropdown_menu", ID);
+    ui_id ID = UI_HashCombine(Ctx->WindowSelected->ID, NameID);
+    ui_id MenuID = UI_HashCombine(ID, UI_ID("dropdown_menu"));
 
     int Height = Ctx->TextHeight + 2;
     int Width = UI_DROPDOWN_WIDTH + UI_DEFAULT_PADDING + Height;
-    ui_v2 Dest = UI_AdvanceCursor(Ctx->WindowSelected, Width, Height);
+    ui_v2 Dest;
+    if(!UI_AdvanceCursor(Ctx->WindowSelected, Width, Height, &Dest) && 
+       Ctx->Active != ID && Ctx->PopUp.ID != MenuID) {
+        return 0;
+    }
 
     ui_rect PreviewBox = UI_Rect(Dest.x, Dest.y, UI_DROPDOWN_WIDTH - Height, Height);
     ui_rect Button = UI_Rect(PreviewBox.x + PreviewBox.w, Dest.y, Height, Height);
@@ -759,29 +2729,33 @@ UI_Dropdown(ui_context *Ctx, char *Name, char **Items, unsigned int ItemCount, u
     float MaxVisibleItems = 7.5;
     int MenuHeight = UI_MAX(UI_MIN(ItemHeight * MaxVisibleItems, ItemHeight * ItemCount), ItemHeight);
     if(UI_UpdateInputState(Ctx, Clickable, ID) == UI_INTERACTION_PRESS) {
-        if(Ctx->PopUp.ID == ID) {
+        if(Ctx->PopUp.ID == MenuID) {
             Ctx->PopUp.ID = 0;
         } else {
             Ctx->PopUp.ID = MenuID;
-            Ctx->DropdownScroll = 0;
+            *(int *)UI_GetState(Ctx, MenuID, sizeof(int)) = 0;
         }
     }
 
     if(Ctx->PopUp.ID == MenuID) {
+        /* The scroll of the menu is kept while it's open */
+        int *Scroll = UI_GetState(Ctx, MenuID, sizeof(int));
         ui_rect Menu = UI_Rect(Clickable.x, Clickable.y - MenuHeight, Width, MenuHeight);
         int MenuInteraction = UI_UpdateInputState(Ctx, Menu, MenuID);
         int SelectedItemIndex = -1;
         if(Ctx->Hot == MenuID) {
             int ScrollSpeed = 6;
             int ScrollRange = ItemHeight * ItemCount - MenuHeight;
-            Ctx->DropdownScroll += Ctx->MouseScroll * ScrollSpeed;
+            *Scroll += Ctx->MouseScroll * ScrollSpeed;
             Ctx->MouseScroll = 0;
-            Ctx->DropdownScroll = UI_Clamp(Ctx->DropdownScroll, 0, ScrollRange);
-            SelectedItemIndex = (Ctx->DropdownScroll + Clickable.y - Ctx->MousePos.y) / ItemHeight;
+            *Scroll = UI_Clamp(*Scroll, 0, ScrollRange);
+            SelectedItemIndex = (*Scroll + Clickable.y - Ctx->MousePos.y) / ItemHeight;
         } else if(MenuInteraction == UI_INTERACTION_PRESS) {
-            Result = 1;
-            SelectedItemIndex = (Ctx->DropdownScroll + Clickable.y - Ctx->MousePos.y) / ItemHeight;
-            *IndexOut = SelectedItemIndex;
+            SelectedItemIndex = UI_MIN((*Scroll + Clickable.y - Ctx->MousePos.y) / ItemHeight, (int)ItemCount - 1);
+            if(SelectedItemIndex >= 0) {
+                Result = 1;
+                *IndexOut = SelectedItemIndex;
+            }
         }
 
         UI_BeginPopUp(Ctx);
@@ -789,14 +2763,15 @@ UI_Dropdown(ui_context *Ctx, char *Name, char **Items, unsigned int ItemCount, u
         UI_PushClipRect(Ctx, Menu);
         UI_DrawRect(Ctx, Menu, UI_COLOR1);
 
-        ui_v2 Cursor = UI_V2(Menu.x, Clickable.y - ItemHeight + Ctx->DropdownScroll);
-        char **It = Items;
-        for(int i = 0; i < ItemCount; i++) {
+        unsigned int First = *Scroll / ItemHeight;
+        unsigned int End = UI_MIN(ItemCount, (unsigned int)((*Scroll + MenuHeight) / ItemHeight + 1));
+        ui_v2 Cursor = UI_V2(Menu.x, Clickable.y - ItemHeight * (First + 1) + *Scroll);
+        for(unsigned int i = First; i < End; i++) {
             ui_rect Item = UI_Rect(Cursor.x, Cursor.y, Menu.w, ItemHeight);
-            UI_DrawText(Ctx, *It, UI_Rect(Item.x + UI_DEFAULT_PADDING, Item.y, Item.w, Item.h), 
-                        (i == SelectedItemIndex) ? UI_COLOR_HIGHLIGHT : UI_COLOR_TEXT, UI_TEXT_OPT_VERT_CENTER);
+            char *Text = GetItem(i, User);
+            UI_DrawText(Ctx, CopyItems ? UI_PushString(Ctx, Text) : Text, UI_Rect(Item.x + UI_DEFAULT_PADDING, Item.y, Item.w, Item.h), 
+                        ((int)i == SelectedItemIndex) ? UI_COLOR_HIGHLIGHT : UI_COLOR_TEXT, UI_TEXT_OPT_VERT_CENTER);
             Cursor.y -= ItemHeight;
-            It = (char **)((char *)It + Stride);
         }
         UI_PopClipRect(Ctx);
 
@@ -813,9 +2788,215 @@ UI_Dropdown(ui_context *Ctx, char *Name, char **Items, unsigned int ItemCount, u
     UI_PushClipRect(Ctx, PreviewBox);
     ui_rect TextP = PreviewBox;
     TextP.x += UI_DEFAULT_PADDING;
-    UI_DrawText(Ctx, *(char **)((char *)Items + Stride * (*IndexOut)), TextP, UI_COLOR_TEXT, UI_TEXT_OPT_VERT_CENTER);
+    if(*IndexOut >= 0 && (unsigned int)*IndexOut < ItemCount) {
+        char *Text = GetItem(*IndexOut, User);
+        UI_DrawText(Ctx, CopyItems ? UI_PushString(Ctx, Text) : Text, TextP, UI_COLOR_TEXT, UI_TEXT_OPT_VERT_CENTER);
+    }
     UI_PopClipRect(Ctx);
 
     return Result;
 }
 
+int
+UI_DropdownGetterID(ui_context *Ctx, ui_id NameID, ui_get_item GetItem, void *User, unsigned int ItemCount, int *IndexOut) {
+    return UI_DropdownCore(Ctx, NameID, GetItem, User, ItemCount, IndexOut, 1);
+}
+
+int
+UI_DropdownGetter(ui_context *Ctx, char *Name, ui_get_item GetItem, void *User, unsigned int ItemCount, int *IndexOut) {
+    return UI_DropdownGetterID(Ctx, UI_HashString(Name), GetItem, User, ItemCount, IndexOut);
+}
+
+typedef struct {
+    char **Items;
+    unsigned int Stride;
+} ui_item_array;
+
+char *
+UI_GetArrayItem(unsigned int Index, void *User) {
+    ui_item_array *Array = User;
+    return *(char **)((char *)Array->Items + Array->Stride * Index);
+}
+
+int
+UI_DropdownID(ui_context *Ctx, ui_id NameID, char **Items, unsigned int ItemCount, unsigned int Stride, int *IndexOut) {
+    ui_item_array Array = {Items, Stride};
+    return UI_DropdownCore(Ctx, NameID, UI_GetArrayItem, &Array, ItemCount, IndexOut, 0);
+}
+
+int
+UI_Dropdown(ui_context *Ctx, char *Name, char **Items, unsigned int ItemCount, unsigned int Stride, int *IndexOut) {
+    return UI_DropdownID(Ctx, UI_HashString(Name), Items, ItemCount, Stride, IndexOut);
+}
+
+/* List */
+
+long long
+UI_ListScrollRange(ui_list *List) {
+    long long Range = List->RowCount * List->RowHeight - List->Height;
+    return (Range > 0) ? Range : 0;
+}
+
+/* The list takes a row of the window as wide as the body. The scroll is
+ * clamped here in case the list got shorter, the scroll bar is handled in
+ * UI_EndList, after the rows, like the one of the window. */
+int
+UI_BeginListID(ui_context *Ctx, ui_id NameID, ui_list *List) {
+    ui_window *Window = Ctx->WindowSelected;
+    UI_ASSERT(!Ctx->ActiveList.List, "Lists can't be nested");
+    UI_ASSERT(List->RowHeight > 0, "Rows of a list need a height");
+
+    int Width = Window->Body.w - 2 * UI_DEFAULT_PADDING;
+    ui_v2 Dest;
+    int Visible = UI_AdvanceCursor(Window, Width, List->Height, &Dest);
+    ui_rect Rect = UI_Rect(Dest.x, Dest.y, Width, List->Height);
+    int Base = Window->Body.y + Window->Body.h - UI_DEFAULT_PADDING + Window->Scroll;
+
+    Ctx->ActiveList.List = List;
+    Ctx->ActiveList.ID = UI_HashCombine(Window->ID, NameID);
+    Ctx->ActiveList.Rect = Rect;
+    Ctx->ActiveList.Visible = Visible;
+    Ctx->ActiveList.Top = Rect.y + Rect.h - Base;
+    Ctx->ActiveList.Cursor = Window->Cursor;
+    Ctx->ActiveList.RowHeight = Window->RowHeight;
+    Ctx->ActiveList.Inline = Window->Inline;
+
+    long long ScrollRange = UI_ListScrollRange(List);
+    List->Scroll = (List->Scroll < 0) ? 0 : (List->Scroll > ScrollRange) ? ScrollRange : List->Scroll;
+    List->First = List->End = 0;
+    if(Visible) {
+        /* Rows in the part of the list inside the visible body, in pixels
+         * from the top of the list */
+        int From = Rect.y + Rect.h - UI_MIN(Rect.y + Rect.h, Window->Visible.y + Window->Visible.h);
+        int To = Rect.y + Rect.h - UI_MAX(Rect.y, Window->Visible.y);
+        List->First = UI_MIN((List->Scroll + From) / List->RowHeight, List->RowCount);
+        List->End = UI_MIN((List->Scroll + To + List->RowHeight - 1) / List->RowHeight, List->RowCount);
+        UI_PushClipRect(Ctx, Rect);
+        Window->Inline = 0;
+    }
+
+    return Visible;
+}
+
+int
+UI_BeginList(ui_context *Ctx, char *Name, ui_list *List) {
+    return UI_BeginListID(Ctx, UI_HashString(Name), List);
+}
+
+/* Moves the cursor to the top of row Row, Row is one of the visible rows */
+void
+UI_ListRow(ui_context *Ctx, long long Row) {
+    ui_window *Window = Ctx->WindowSelected;
+    ui_list *List = Ctx->ActiveList.List;
+    UI_ASSERT(List, "UI_ListRow must be called between UI_BeginList and UI_EndList");
+    Window->Cursor.x = Window->Body.x;
+    Window->Cursor.y = Ctx->ActiveList.Top - (int)(Row * List->RowHeight - List->Scroll);
+    Window->RowHeight = 0;
+    if(Window->Columns) {
+        Window->Columns->Column = 0;
+    }
+}
+
+void
+UI_EndList(ui_context *Ctx) {
+    ui_window *Window = Ctx->WindowSelected;
+    ui_list *List = Ctx->ActiveList.List;
+    UI_ASSERT(List, "UI_EndList must follow UI_BeginList");
+    ui_rect Rect = Ctx->ActiveList.Rect;
+    if(Ctx->ActiveList.Visible) {
+        UI_PopClipRect(Ctx);
+    }
+
+    ui_id ScrollID = UI_HashCombine(Ctx->ActiveList.ID, UI_ID("scroll_bar"));
+    long long ScrollRange = UI_ListScrollRange(List);
+    int Over = UI_OverWindow(Ctx, Window) && UI_PointInsideRect(Rect, Ctx->MousePos);
+    if(ScrollRange > 0 && ((Ctx->ActiveList.Visible && Over) || Ctx->Active == ScrollID)) {
+        int Width = 8;
+        ui_rect Track = UI_Rect(Rect.x + Rect.w - Width, Rect.y, Width, Rect.h);
+        /* The slider keeps a minimum size, it would be a fraction of a pixel 
+         * for long lists */
+        int SliderHeight = Track.h * ((double)Rect.h / (ScrollRange + Rect.h));
+        ui_rect Slider = UI_Rect(Track.x, Track.y, Track.w, UI_MAX(SliderHeight, Width));
+
+        UI_UpdateInputState(Ctx, Track, ScrollID);
+        if(Ctx->Active == ScrollID && Track.h > Slider.h) {
+            int dY = Ctx->MousePosPrev.y - Ctx->MousePos.y;
+            List->Scroll += (long long)((double)dY / (Track.h - Slider.h) * ScrollRange);
+        }
+        if(Over) {
+            List->Scroll += Ctx->MouseScroll * 10;
+            Ctx->MouseScroll = 0;
+        }
+        List->Scroll = (List->Scroll < 0) ? 0 : (List->Scroll > ScrollRange) ? ScrollRange : List->Scroll;
+
+        double N = 1. - (double)List->Scroll / ScrollRange;
+        Slider.y = (Track.h - Slider.h) * N + Track.y;
+
+        UI_DrawRect(Ctx, Track, UI_COLOR1);
+        UI_DrawRect(Ctx, Slider, UI_COLOR4);
+    }
+
+    Window->Cursor = Ctx->ActiveList.Cursor;
+    Window->RowHeight = Ctx->ActiveList.RowHeight;
+    Window->Inline = Ctx->ActiveList.Inline;
+    Ctx->ActiveList.List = 0;
+}
+
+/* Child regions */
+
+/* The region takes a row of the selected window or region, its rect is set
+ * every frame so it follows the layout and the scroll of what it's in. */
+int
+UI_BeginChildID(ui_context *Ctx, ui_id NameID, int Width, int Height) {
+    ui_window *Parent = Ctx->WindowSelected;
+    UI_ASSERT(Parent, "Child regions must be inside a window");
+    ui_id ID = UI_HashCombine(Parent->ID, NameID);
+    ui_window *Child = UI_FindWindow(Ctx, ID);
+    if(!Child) {
+        Child = UI_CreateWindow(Ctx, ID);
+        Child->Parent = Parent;
+    }
+    UI_ASSERT(Child->Parent == Parent, "A child region must stay in the same window");
+
+    if(Width <= 0) {
+        Width = Parent->Body.w - 2 * UI_DEFAULT_PADDING;
+    }
+    ui_v2 Dest;
+    int Visible = UI_AdvanceCursor(Parent, Width, Height, &Dest);
+    Child->Rect = Child->Body = UI_Rect(Dest.x, Dest.y, Width, Height);
+    Child->Cursor = UI_V2(Child->Body.x, 0);
+    Child->RowHeight = 0;
+    Child->Inline = 0;
+    Child->Columns = 0;
+    Child->Layouts.Index = 0;
+    Child->Interacted = 0;
+
+    Ctx->WindowSelected = Child;
+    UI_PushClipRect(Ctx, Child->Body);
+    Child->Visible = Ctx->ClipStack.Items[Ctx->ClipStack.Index - 1];
+    return Visible;
+}
+
+int
+UI_BeginChild(ui_context *Ctx, char *Name, int Width, int Height) {
+    return UI_BeginChildID(Ctx, UI_HashString(Name), Width, Height);
+}
+
+void
+UI_EndChild(ui_context *Ctx) {
+    ui_window *Child = Ctx->WindowSelected;
+    UI_ASSERT(Child && Child->Parent, "UI_EndChild must follow UI_BeginChild");
+    ui_rect Clip = Ctx->ClipStack.Items[Ctx->ClipStack.Index - 1];
+    int Over = UI_OverWindow(Ctx, Child) && Clip.w > 0 && Clip.h > 0 &&
+               UI_PointInsideRect(Clip, Ctx->MousePos);
+
+    int Width = 8;
+    ui_rect Track = UI_Rect(Child->Body.x + Child->Body.w - Width, Child->Body.y, Width, Child->Body.h);
+    UI_ScrollBar(Ctx, Child, Track, Over);
+    UI_PopClipRect(Ctx);
+
+    Ctx->WindowSelected = Child->Parent;
+    if(Child->Interacted) {
+        Child->Parent->Interacted = 1;
+    }
+}
@@ -1,9 +1,33 @@
 #ifndef ui_h
 #define ui_h
 
-#define UI_WINDOW_MAX 32
-#define UI_COMMAND_MAX 1024
-#define UI_TEXT_MAX 16384
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Windows are allocated this many at a time */
+#define UI_WINDOW_PAGE_SIZE 32
+
+/* Default sizes of the memory chunks commands and text are allocated from.
+ * Chunks are kept between frames so a frame that fits in the memory of the
+ * previous one allocates nothing. */
+#define UI_COMMAND_CHUNK_SIZE 65536
+#define UI_TEXT_CHUNK_SIZE 16384
+
+#define UI_CLIP_STACK_MAX 64
+
+/* The window rects of the last frame are put in a grid of this many cells on
+ * each side to find the window under a point */
+#define UI_WINDOW_GRID_SIZE 16
+
+/* Opaque window rects kept by CullOccluded, windows below more than this many
+ * opaque windows are only tested against the nearest ones */
+#define UI_OCCLUDER_MAX 32
+
+/* Damage rects that would exceed the maximum are merged into the others */
+#define UI_DAMAGE_RECT_MAX 16
 
 #define UI_DEFAULT_PADDING 5
 
@@ -13,11 +37,74 @@
 #define UI_WINDOW_MIN_HEIGHT 200
 #define UI_WINDOW_RESIZE_ICON_SIZE 15
 
+/* Bytes of state kept per ID and states allocated at a time, see 
+ * UI_GetState */
+#define UI_STATE_SIZE 32
+#define UI_STATE_PAGE_SIZE 256
+
+/* Widths kept by the text measurement cache and entries per set, see
+ * UI_MeasureText */
+#define UI_TEXT_CACHE_SIZE 1024
+#define UI_TEXT_CACHE_WAYS 4
+
+/* Columns of a column layout, see UI_Columns */
+#define UI_COLUMN_MAX 64
+
 #define UI_BUTTON_WIDTH 80
 #define UI_DROPDOWN_WIDTH 160
 
 typedef unsigned int ui_id;
 
+/* IDs are hashes of strings. The string is hashed four bytes at a time, each
+ * word is mixed with its index and the mixed words are summed, so the hash of
+ * a string literal can be written as a single expression. UI_ID("Label") is
+ * that expression: an optimizing C compiler folds it to a constant and a C++
+ * compiler evaluates it with constexpr. It gives the same ID as UI_Hash for
+ * the same string and only takes string literals. Literals longer than
+ * UI_ID_LITERAL_MAX are hashed at runtime. */
+#define UI_ID_LITERAL_MAX 32
+
+#ifdef __cplusplus
+#define UI_HASH_FUNCTION static inline constexpr
+#else
+#define UI_HASH_FUNCTION static inline
+#endif
+
+UI_HASH_FUNCTION unsigned int
+UI_HashMix(unsigned int x) {
+    return x ^ (x >> 16);
+}
+
+UI_HASH_FUNCTION unsigned int
+UI_HashWord(unsigned int Word, unsigned int Index) {
+    return UI_HashMix((Word ^ (Index * 0x9e3779b9u)) * 0x85ebca6bu);
+}
+
+UI_HASH_FUNCTION ui_id
+UI_HashFinalize(unsigned int Sum, unsigned int Length) {
+    return UI_HashMix((Sum ^ Length) * 0xc2b2ae35u);
+}
+
+/* Combines the hash of a string with the ID of its parent, a seed of 0 leaves
+ * the hash as it is */
+UI_HASH_FUNCTION ui_id
+UI_HashCombine(ui_id Seed, ui_id Hash) {
+    return Seed ? UI_HashMix(((Seed * 0x9e3779b9u) ^ Hash) * 0x85ebca6bu) : Hash;
+}
+
+#ifndef __cplusplus
+#define UI_ID_BYTE(S, i) ((i) < sizeof(S) - 1 ? (unsigned int)(unsigned char)(S)[(i) < sizeof(S) ? (i) : 0] : 0u)
+#define UI_ID_WORD(S, i) (UI_ID_BYTE(S, 4 * (i)) | UI_ID_BYTE(S, 4 * (i) + 1) << 8 | \
+                          UI_ID_BYTE(S, 4 * (i) + 2) << 16 | UI_ID_BYTE(S, 4 * (i) + 3) << 24)
+#define UI_ID_TERM(S, i) (4 * (i) < sizeof(S) - 1 ? UI_HashWord(UI_ID_WORD(S, i), i) : 0u)
+#define UI_ID_LITERAL(S) (sizeof(S) - 1 > UI_ID_LITERAL_MAX ? UI_HashString(S) : \
+                          UI_HashFinalize(UI_ID_TERM(S, 0) + UI_ID_TERM(S, 1) + UI_ID_TERM(S, 2) + \
+                                          UI_ID_TERM(S, 3) + UI_ID_TERM(S, 4) + UI_ID_TERM(S, 5) + \
+                                          UI_ID_TERM(S, 6) + UI_ID_TERM(S, 7), sizeof(S) - 1))
+/* Pasting "" in front of S fails to compile for anything but a literal */
+#define UI_ID(S) UI_ID_LITERAL("" S)
+#endif
+
 enum {
     UI_ICON_RESIZE,
     UI_ICON_COLLAPSE,
@@ -30,7 +117,9 @@ enum {
     UI_COMMAND_RECT,
     UI_COMMAND_TEXT,
     UI_COMMAND_ICON,
-    UI_COMMAND_BLOCK
+    UI_COMMAND_CLIP,
+    UI_COMMAND_BLOCK,
+    UI_COMMAND_TYPE_COUNT
 };
 
 enum {
@@ -58,12 +147,25 @@ enum {
     UI_INTERACTION_PRESS_AND_RELEASED
 };
 
+enum {
+    UI_COLUMN_FIXED,
+    UI_COLUMN_FRACTION,
+    UI_COLUMN_AUTO
+};
+
 /* Types */
 
 typedef struct {
     int x, y;
 } ui_v2;
 
+/* Length bytes of text at Data, not necessarily terminated. A view into a 
+ * larger buffer can be passed without copying it. */
+typedef struct {
+    char *Data;
+    int Length;
+} ui_str;
+
 /* (x, y) marks the lower-left corner of  the rectangle */
 typedef struct {
     int x, y, w, h;
@@ -75,84 +177,306 @@ typedef struct {
 
 /* Widgets */
 
+/* Returns the text of item Index of a dropdown, see UI_DropdownGetter. The
+ * text is copied and only has to stay valid until the next call. */
+typedef char *(* ui_get_item)(unsigned int Index, void *User);
+
+/* RowCount rows of RowHeight pixels in a region Height pixels high, see 
+ * UI_BeginList. Scroll is how far the list is scrolled in pixels and is kept
+ * by the caller between frames, offsets are 64-bit so lists of any length can
+ * be scrolled. UI_BeginList writes the visible rows, First up to End. */
+typedef struct {
+    long long RowCount;
+    int RowHeight;
+    int Height;
+    long long Scroll;
+    long long First, End;
+} ui_list;
+
+/* Size is the width in pixels of a fixed column and the share of the width 
+ * left by the other columns of a fractional column. An auto column is as wide
+ * as its widest widget in the last frame. */
+typedef struct {
+    int Type;
+    float Size;
+} ui_column;
+
+/* A column layout of a window, see UI_Columns. The offsets of the columns
+ * from the body are kept across frames and only resolved again when the 
+ * columns, the width of the body or the widths measured for the auto columns
+ * in the last frame change. Column is the cell the next widget goes in, Count
+ * once the row is full. */
+typedef struct {
+    int Count, Column;
+    ui_column Specs[UI_COLUMN_MAX];
+    int BodyWidth;
+    int Offsets[UI_COLUMN_MAX];
+    /* The widths of the auto columns the offsets were resolved for and the
+     * widest widget of each auto column since UI_Columns */
+    int AutoWidths[UI_COLUMN_MAX];
+    int Measured[UI_COLUMN_MAX];
+    int Inline;
+} ui_columns;
+
+/* The body commands of a window's last build, see UI_CachedWindow. Memory 
+ * holds the commands followed by copies of their text. */
 typedef struct {
+    int Valid;
+    unsigned int Version;
+    ui_rect Rect, Body, Viewport;
+    int Scroll;
+    int ResolveClip;
+    int Interacted;
+
+    unsigned char *Memory;
+    size_t Capacity;
+    size_t CommandSize; /* Bytes of commands at the start of Memory */
+    int CommandCount;
+    int TypeCount[UI_COMMAND_TYPE_COUNT];
+    ui_rect Bounds, Clip; /* Of the block at the end of the body */
+} ui_window_cache;
+
+typedef struct ui_window {
     ui_id ID;
     ui_rect Rect; 
     ui_rect Title;
     ui_rect Body;
+    /* The part of Body that can be seen, widgets outside it are culled. For a
+     * child region the body is cut to what's visible of the window it's in. */
+    ui_rect Visible;
 
     int ZIndex;
+    /* Neighbours in the depth order, 0 at the top and bottom */
+    struct ui_window *Above, *Below;
+    /* The window a child region is in, 0 for windows. Child regions aren't in
+     * the depth order and have no block, Rect and Body are the region. */
+    struct ui_window *Parent;
 
     int Scroll;
 
-    /* TODO: Support multiple columns */
+    /* A collapsed window is only its title bar, Rect.h is restored from 
+     * ExpandedHeight when it's expanded */
+    int Collapsed;
+    int ExpandedHeight;
+
+    /* Index of the window's block in CommandRefStack if the window was 
+     * created in frame Frame */
+    unsigned int Frame;
+    int BlockRef;
+
+    /* Interacted is set if a widget in the window is hot or active or opened
+     * the pop-up this frame. The body starts at BodyOffset in the block. */
+    int Interacted;
+    int Caching, Replayed;
+    unsigned int BodyOffset;
+    /* Set if the widgets of the body weren't built this frame because the
+     * window is hidden or was replayed, their state is kept */
+    int BodySkipped;
+    ui_window_cache Cache;
+
     int RowHeight; 
     int Inline;
     ui_v2 Cursor;
+    /* The column layouts of the window in the order UI_Columns is called in
+     * a frame, Layouts.Index is the next one. Columns is the layout between
+     * UI_Columns and UI_EndColumns, 0 outside of it. */
+    ui_columns *Columns;
+    struct { unsigned int Index, Capacity; ui_columns *Items; } Layouts;
 } ui_window;
 
+typedef struct ui_window_page {
+    struct ui_window_page *Next;
+    unsigned int Count;
+    ui_window Items[UI_WINDOW_PAGE_SIZE];
+} ui_window_page;
+
+/* State of a widget kept across frames, see UI_GetState. Frame is the last
+ * frame it was asked for in, Window the window it was asked for in, 0 outside
+ * of windows. Prev and Next link it into the list of its frame. */
+typedef struct ui_state {
+    ui_id ID;
+    unsigned int Frame;
+    struct ui_window *Window;
+    struct ui_state *Prev, *Next;
+    union {
+        void *Pointer;
+        double Number;
+        long long Integer;
+        unsigned char Bytes[UI_STATE_SIZE];
+    } Data;
+} ui_state;
+
+typedef struct ui_state_page {
+    struct ui_state_page *Next;
+    unsigned int Count;
+    ui_state Items[UI_STATE_PAGE_SIZE];
+} ui_state_page;
+
+/* Width of measured text, see TextCache. Frame is the last frame it was 
+ * looked up in, 0 if the entry is empty. */
+typedef struct {
+    ui_id Hash;
+    int Length;
+    int Width;
+    unsigned int Frame;
+} ui_text_width;
+
 /* Commands */
 
+typedef struct ui_memory_chunk {
+    struct ui_memory_chunk *Next;
+    size_t Size;
+    size_t Used;
+} ui_memory_chunk;
+
+/* Commands are packed in a byte stream. Each command starts with a header
+ * and is followed by only the payload of its type, Size is the number of bytes
+ * to the next command. */
+typedef struct {
+    unsigned short Type;
+    unsigned short Size;
+} ui_command_header;
+
+/* A block holds the commands of a window or a pop-up. The commands follow
+ * the block command in memory, see UI_BLOCK_BEGIN and UI_BLOCK_END. */
 typedef struct {
+    ui_command_header Header;
+    ui_id ID; /* ID of the window or pop-up */
     int ZIndex;
-    int CommandCount;
-    int Direction;
+    ui_rect Bounds; /* Bounding box of the visible parts of all rects, text and icons */
+    ui_rect Clip; /* Clip rect of the most recent command when clip rects are resolved */
+    ui_rect Opaque; /* Area the block covers with opaque pixels, used by CullOccluded */
+    int CommandCount; /* Excluding the block command itself */
+    int TypeCount[UI_COMMAND_TYPE_COUNT]; /* Number of commands of each type */
+    unsigned int Size; /* In bytes, including the block command itself */
+    int Dropped;
+    ui_memory_chunk *Chunk; /* The chunk the block is allocated in */
+    int Ref; /* Index of the block's reference in CommandRefStack until UI_End */
 } ui_command_block;
 
+/* Used by UI_COMMAND_PUSH_CLIP and UI_COMMAND_CLIP */
 typedef struct {
+    ui_command_header Header;
     ui_rect Rect;
-} ui_command_push_clip;
+} ui_command_clip;
 
 typedef struct {
-    ui_rect Rect;
+    ui_command_header Header;
     ui_color Color;
+    ui_rect Rect;
 } ui_command_rect;
 
 typedef struct {
-    ui_rect Rect;
+    ui_command_header Header;
     ui_color Color;
+    ui_rect Rect;
+    /* Length bytes, only terminated if the text was passed as a C string */
     char *Text;
+    int Length;
 } ui_command_text;
 
 typedef struct {
-    ui_rect Rect;
+    ui_command_header Header;
     ui_color Color;
+    ui_rect Rect;
     int ID;
 } ui_command_icon;
 
-typedef struct {
-    int Type;
-    union {
-        ui_command_push_clip Clip;
-        ui_command_rect Rect;
-        ui_command_text Text;
-        ui_command_icon Icon;
-        ui_command_block Block;
-    } Command;    
+#define UI_BLOCK_BEGIN(Block) ((ui_command *)((unsigned char *)(Block) + sizeof(ui_command_block)))
+#define UI_BLOCK_END(Block) ((ui_command *)((unsigned char *)(Block) + (Block)->Size))
+#define UI_NEXT_COMMAND(Command) ((ui_command *)((unsigned char *)(Command) + (Command)->Header.Size))
+
+/* Only the bytes of the member matching Type are valid */
+typedef union {
+    unsigned short Type;
+    ui_command_header Header;
+    ui_command_clip Clip;
+    ui_command_rect Rect;
+    ui_command_text Text;
+    ui_command_icon Icon;
 } ui_command;
 
+/* Target is 0 if the block was dropped. SortKey is the position of the 
+ * block in the draw order, assigned in UI_End. */
 typedef struct {
-    ui_command *Target; 
+    ui_command_block *Target; 
     int SortKey;
 } ui_command_ref;
 
+/* What was drawn in a frame, compared with the next frame to find the 
+ * damaged areas. The commands of each block are a range of Commands. */
+typedef struct {
+    ui_rect Rect;
+    unsigned int Hash;
+    int Type;
+} ui_command_digest;
+
+typedef struct {
+    ui_id ID;
+    unsigned int Hash;
+    ui_rect Bounds;
+    unsigned int First, Count;
+    int Match; /* Index of the same block in the other frame, -1 if there's none */
+} ui_block_digest;
+
+typedef struct {
+    int Valid;
+    unsigned int Frame; /* The frame it was recorded in */
+    ui_rect Viewport;
+    struct { unsigned int Index, Capacity; ui_block_digest *Items; } Blocks;
+    struct { unsigned int Index, Capacity; ui_command_digest *Items; } Commands;
+} ui_frame_digest;
+
 typedef struct {
     int TextHeight;
     int (* TextWidth)(char *Text);
+    /* Width of Length bytes of Text, which isn't terminated. Used instead of 
+     * TextWidth if set, otherwise text passed as a ui_str is copied and 
+     * terminated to be measured. */
+    int (* MeasureText)(char *Text, int Length);
+    /* Set with UI_SetGlyphAdvances. Text is measured from the table without
+     * calling MeasureText or TextWidth, they're only called for text that
+     * isn't ASCII. Monospace is set if all advances are the same. */
+    struct { int Valid, Monospace; int Advance[128]; } Glyphs;
+
+    /* All memory is requested through Alloc and Free, malloc and free are 
+     * used if they're not set. */
+    void *(* Alloc)(size_t Size);
+    void (* Free)(void *Memory);
+
+    /* If MemoryBudget is non-zero no more than MemoryBudget bytes are 
+     * allocated. When the budget is exhausted the commands of the windows with
+     * the lowest z-index are dropped and counted instead of aborting. The
+     * counts are reset in UI_Begin. The windows, their index and layouts, 
+     * widget state and the text cache are counted in MemoryUsed but never
+     * refused as they can't be dropped, they leave less for the commands. */
+    size_t MemoryBudget;
+    size_t MemoryUsed;
+    int DroppedBlockCount;
+    int DroppedCommandCount;
+    int DroppedTextCount;
     ui_v2 MousePosPrev;
     ui_v2 MousePos;
 
     ui_id Active;
     ui_id Hot;
+    /* Hot at the end of the last frame. Overlapping widgets under the mouse
+     * take Hot in turn, only the last one built, which ends up hot, can be
+     * pressed. */
+    ui_id HotPrev;
     int SomethingIsHot;
 
     /* The top z-index is incremented each time a window is created as they
      * are created on top, also when a window not on top gets brought to the 
-     * top */
+     * top. The z-indices are renumbered from 0 in UI_Begin before they can
+     * overflow. */
     int ZIndexTop;
 
-    int CmdIndex;
+    unsigned int Frame; /* Incremented in UI_Begin */
+
+    unsigned int CmdOffset; /* Byte offset of the next command in the block */
     int CmdRefIndex;
+    int BlockRefIndex; /* Next block returned by UI_NextBlock */
 
     /* If we draw and there's no active block then we're not drawing in a window.
      * In this case set the ZIndex of the block to such that all draw commands not
@@ -166,7 +490,68 @@ typedef struct {
         int MarkedForDeath; /* Mouse button was pressed that was not inside 
                                the pop-up, it gets marked for death */
     } PopUp;
-    int DropdownScroll; /* Used when a pop-up is a dropdown menu */
+
+    /* The list between UI_BeginList and UI_EndList. Top is the top of Rect in
+     * the cursor coordinates of the window, the cursor of the window is
+     * restored to Cursor, RowHeight and Inline when the list ends. */
+    struct {
+        ui_list *List;
+        ui_id ID;
+        ui_rect Rect;
+        int Visible, Top;
+        ui_v2 Cursor;
+        int RowHeight, Inline;
+    } ActiveList;
+
+    /* If Viewport has a size, commands outside of it are culled */
+    ui_rect Viewport;
+
+    /* If ResolveClip is set no UI_COMMAND_PUSH_CLIP or UI_COMMAND_POP_CLIP
+     * commands are emitted. Instead a UI_COMMAND_CLIP command with the 
+     * intersection of all clip rects is emitted before a command that needs a
+     * different clip rect than the previous command in the block. Each block 
+     * starts clipped to the viewport. */
+    int ResolveClip;
+    /* Commands entirely outside their clip rect are not emitted, they're 
+     * counted here. Reset in UI_Begin */
+    int CulledCommandCount;
+    /* Intersection of the clip rects pushed so far, the bottom of each block is
+     * the viewport */
+    struct { unsigned int Index; ui_rect Items[UI_CLIP_STACK_MAX]; } ClipStack;
+
+    /* If GroupCommands is set the commands of each block are reordered when
+     * it ends so rects and textured commands (text and icons) form longer 
+     * runs, a backend that draws them differently changes state less often.
+     * Two commands only swap places if their rects don't overlap, and never
+     * across a clip command. Touching rects of the same color are merged into
+     * one, as is an opaque rect and a rect of the same color inside it. Merges
+     * are counted in MergedCommandCount, reset in UI_Begin. */
+    int GroupCommands;
+    int MergedCommandCount;
+    struct { size_t Size; void *Memory; } GroupScratch;
+
+    /* If CullOccluded is set UI_End drops the commands that are covered by
+     * the opaque rect of a window in front of them, and whole blocks when 
+     * all they draw is covered. The dropped commands and blocks are counted
+     * in OccludedCommandCount and OccludedBlockCount, reset in UI_Begin. */
+    int CullOccluded;
+    int OccludedCommandCount;
+    int OccludedBlockCount;
+
+    /* Windows begun with UI_CachedWindow that were replayed or rebuilt this 
+     * frame, reset in UI_Begin */
+    int ReplayHitCount;
+    int ReplayMissCount;
+
+    /* If TrackDamage is set UI_End compares what is drawn with the previous 
+     * frame and writes the areas that changed to DamageRects, including the
+     * areas windows moved away from or closed. Only those need to be drawn 
+     * again. Everything is damaged in the first frame, when the viewport 
+     * changes and when the previous frame wasn't tracked. */
+    int TrackDamage;
+    int DamageRectCount;
+    ui_rect DamageRects[UI_DAMAGE_RECT_MAX];
+    ui_frame_digest Digests[2]; /* Alternate between frames */
 
     int MouseScroll; /* Consumed and set to 0 */
     struct {
@@ -174,45 +559,112 @@ typedef struct {
         ui_v2 P;
     } MouseEvent;
 
-    unsigned int TextBufferTop;
-    char TextBuffer[UI_TEXT_MAX];
+    ui_memory_chunk *TextChunks;
+    ui_memory_chunk *TextChunk; /* Chunk currently allocated from */
 
     /* The current window being edited between a pair of calls to UI_Window
      * and UI_EndWindow */
     ui_window *WindowSelected;
 
-    /* Top index is the same as number of windows, i.e. WindowStack.Index.
-     * The rationale for WindowDepthOrder is having a place where the order of
-     * the windows is described. WindowDepthOrder is not needed for rendering
-     * the windows correctly as the block commands include a z-index. But it 
-     * does make it easier to determine which window a mouse button press hits. */
-    ui_window *WindowDepthOrder[UI_WINDOW_MAX];
-    struct { unsigned int Index; ui_window Items[UI_WINDOW_MAX]; } WindowStack;
-
-    /* -------
-     * |     | |
-     * |     | | pop-up draw commands, Index2
-     * |     | |
-     * |~~~~~| v
-     * |     | 
-     * |~~~~~| ^
-     * |     | | regular draw commands. Index
-     * ------- |
-     */ 
-    struct { unsigned int Index, Index2; ui_command Items[UI_COMMAND_MAX]; } CommandStack;
-    struct { unsigned int Index; ui_command_ref Items[UI_COMMAND_MAX]; } CommandRefStack;
+    /* Windows are allocated in pages and never move, a pointer to a window is
+     * valid until UI_Release. WindowIndex maps IDs to windows with open 
+     * addressing, Capacity is a power of two and at least twice WindowCount. */
+    ui_window_page *WindowPages;
+    unsigned int WindowCount;
+    struct { unsigned int Capacity; ui_window **Slots; } WindowIndex;
+
+    /* The depth order of the windows, linked through Above and Below. It's
+     * the draw order and the order a mouse button press hits the windows in,
+     * a window is brought to the top by relinking it. */
+    ui_window *WindowBottom, *WindowTop;
+
+    /* The topmost window under MousePos, resolved in UI_Begin, and under 
+     * MouseEvent.P, resolved in UI_MouseButton. Only widgets in HoverWindow
+     * can become hot. Windows that weren't built last frame are skipped. */
+    ui_window *HoverWindow;
+    ui_window *EventWindow;
+    /* Built in UI_End from the window rects of the frame. The windows in a 
+     * cell are Items[CellStart[Cell]] up to Items[CellStart[Cell + 1]]. The 
+     * grid covers the viewport or all windows if there's no viewport, cells 
+     * at the edge hold everything beyond it. */
+    struct {
+        int Valid;
+        ui_rect Bounds;
+        unsigned int CellStart[UI_WINDOW_GRID_SIZE * UI_WINDOW_GRID_SIZE + 1];
+        unsigned int Capacity;
+        ui_window **Items;
+    } WindowGrid;
+
+    /* Widget state by ID. States are allocated in pages and reused from Free,
+     * Slots maps IDs to states with open addressing, Capacity is a power of
+     * two and at least twice Count. Touched are the states asked for this
+     * frame, Untouched the ones asked for last frame and not yet in this one.
+     * UI_End evicts those unless their window was begun this frame but its
+     * body wasn't built, see BodySkipped. The lookups of the frame, the slots
+     * they probed, the longest probe and the states evicted in UI_End are
+     * counted, the counts are reset in UI_Begin. */
+    struct {
+        ui_state_page *Pages;
+        ui_state *Free;
+        ui_state *Touched, *Untouched;
+        unsigned int Count, Capacity;
+        ui_state **Slots;
+        unsigned int LookupCount, ProbeCount, ProbeMax, EvictedCount;
+    } States;
+
+    /* Widths of text measured by MeasureText or TextWidth, looked up by the
+     * hash and length of the text. Entries are in sets of UI_TEXT_CACHE_WAYS,
+     * a miss replaces the entry of its set that was looked up longest ago.
+     * The cache is flushed when the callbacks change, UI_FlushTextCache 
+     * flushes it when the font changes behind the same callback. Hits, misses
+     * and replaced entries are counted, the counts are reset in UI_Begin. */
+    struct {
+        ui_text_width *Items;
+        int (* TextWidth)(char *Text);
+        int (* MeasureText)(char *Text, int Length);
+        unsigned int HitCount, MissCount, EvictedCount;
+    } TextCache;
+
+    /* A block is contiguous and always lives in a single chunk. A block that
+     * is still open is at the end of its chunk so it can grow, when the chunk
+     * is full the block is moved to a chunk with more space. The pop-up block
+     * and the window block it interrupted are both open at the same time and
+     * never share a chunk. */
+    ui_memory_chunk *CommandChunks;
+    struct { unsigned int Index, Capacity; ui_command_ref *Items; } CommandRefStack;
+    /* In budget mode the closed blocks of the frame are kept in a binary heap
+     * of indices in CommandRefStack, the block with the lowest z-index on top,
+     * so the block to evict is found without a search */
+    struct { unsigned int Count, Capacity; int *Items; } ClosedBlocks;
+
+    /* Commands of dropped blocks are written here and never read */
+    ui_command_block DiscardedBlock;
+    ui_command DiscardedCommand;
 } ui_context;
 
 void UI_Begin(ui_context *Ctx);
 void UI_End(ui_context *Ctx);
+void UI_Release(ui_context *Ctx);
 
 ui_rect UI_Rect(int x, int y, int w, int h);
 ui_color UI_Color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 ui_id UI_Hash(char *Name, ui_id Hash);
+ui_id UI_HashString(char *Str);
+ui_id UI_HashStr(ui_str Str);
+ui_str UI_Str(char *Data, int Length);
+ui_str UI_CStr(char *Str);
+/* Advance holds the widths of the 128 ASCII characters, e.g. the Advance of
+ * ui_draw_metrics. Bytes that aren't ASCII are measured as '?' unless 
+ * MeasureText or TextWidth is set. */
+void UI_SetGlyphAdvances(ui_context *Ctx, int *Advance);
+void UI_FlushTextCache(ui_context *Ctx);
 
 int UI_NextCommand(ui_context *Ctx, ui_command **Command);
+int UI_NextBlock(ui_context *Ctx, ui_command_block **Block);
 
-void UI_Window(ui_context *Ctx, char *Name, int x, int y);
+int UI_Window(ui_context *Ctx, char *Name, int x, int y);
+int UI_WindowID(ui_context *Ctx, ui_id ID, char *Name, int x, int y);
+int UI_CachedWindow(ui_context *Ctx, char *Name, int x, int y, unsigned int Version);
 ui_window *UI_FindWindow(ui_context *Ctx, ui_id ID);
 void UI_EndWindow(ui_context *Ctx);
 
@@ -225,13 +677,101 @@ int UI_Button(ui_context *Ctx, char *Label);
 int UI_Number(ui_context *ctx, char *Name, float Step, float *Value);
 int UI_Slider(ui_context *Ctx, char *Name, float Low, float High, float *Value);
 int UI_Dropdown(ui_context *Ctx, char *Name, char **Items, unsigned int ItemCount, unsigned int Stride, int *IndexOut);
+/* Takes the items from GetItem instead of an array. Only the selected item
+ * and the items in the visible part of an open menu are requested. */
+int UI_DropdownGetter(ui_context *Ctx, char *Name, ui_get_item GetItem, void *User, unsigned int ItemCount, int *IndexOut);
 int UI_CheckBox(ui_context *Ctx, char *Label, int DrawLabel, int *ValueOut);
+/* Take the text as a ui_str, e.g. a line of a larger buffer, which is drawn
+ * from where it is without being copied */
+void UI_TextStr(ui_context *Ctx, ui_str Text, ui_color Color);
+int UI_ButtonStr(ui_context *Ctx, ui_str Label);
+
+/* Only the rows First up to End are built, each starts with UI_ListRow:
+ *     if(UI_BeginList(Ctx, "Results", &List)) {
+ *         for(long long Row = List.First; Row < List.End; Row++) {
+ *             UI_ListRow(Ctx, Row);
+ *             UI_Text(Ctx, RowText(Row), White);
+ *         }
+ *     }
+ *     UI_EndList(Ctx);
+ * UI_BeginList returns 0 if the list is scrolled out of the window body, 
+ * UI_EndList must be called either way. */
+int UI_BeginList(ui_context *Ctx, char *Name, ui_list *List);
+void UI_ListRow(ui_context *Ctx, long long Row);
+void UI_EndList(ui_context *Ctx);
+
+/* A child region is a part of the window with its own cursor, scroll and
+ * clip rect, its widgets are culled against the region. A Width of 0 or less
+ * is the width of the body. Child regions can be nested:
+ *     if(UI_BeginChild(Ctx, "Log", 0, 200)) {
+ *         UI_Text(Ctx, LogText, White);
+ *     }
+ *     UI_EndChild(Ctx);
+ * UI_BeginChild returns 0 if the region is scrolled out of the body it is in,
+ * UI_EndChild must be called either way. */
+int UI_BeginChild(ui_context *Ctx, char *Name, int Width, int Height);
+void UI_EndChild(ui_context *Ctx);
+
+/* Take the ID of the label or name instead of hashing it, e.g. UI_ID("Label") */
+int UI_ButtonID(ui_context *Ctx, ui_id LabelID, char *Label);
+int UI_ButtonStrID(ui_context *Ctx, ui_id LabelID, ui_str Label);
+int UI_NumberID(ui_context *Ctx, ui_id ID, float Step, float *Value);
+int UI_SliderID(ui_context *Ctx, ui_id ID, float Low, float High, float *Value);
+int UI_DropdownID(ui_context *Ctx, ui_id NameID, char **Items, unsigned int ItemCount, unsigned int Stride, int *IndexOut);
+int UI_DropdownGetterID(ui_context *Ctx, ui_id NameID, ui_get_item GetItem, void *User, unsigned int ItemCount, int *IndexOut);
+int UI_CheckBoxID(ui_context *Ctx, ui_id ID, char *Label, int DrawLabel, int *ValueOut);
+int UI_BeginListID(ui_context *Ctx, ui_id NameID, ui_list *List);
+int UI_BeginChildID(ui_context *Ctx, ui_id NameID, int Width, int Height);
 
 void UI_DrawRect(ui_context *Ctx, ui_rect Rect, ui_color Color);
 void UI_DrawIcon(ui_context *Ctx, int ID, ui_rect Rect, ui_color Color);
 ui_rect UI_DrawText(ui_context *Ctx, char *Text, ui_rect Rect, ui_color Color, int Options);
+ui_rect UI_DrawTextStr(ui_context *Ctx, ui_str Text, ui_rect Rect, ui_color Color, int Options);
+
+/* Returns Size bytes of state of ID that are zero when it's first asked for.
+ * The state is kept as long as it's asked for every frame or its window
+ * skips its body, it's evicted in UI_End of another frame it wasn't asked
+ * for in. At most UI_STATE_SIZE bytes. */
+void *UI_GetState(ui_context *Ctx, ui_id ID, size_t Size);
 
 void UI_Inline(ui_context *Ctx);
+/* Lays the widgets out in Count columns until UI_EndColumns, one widget per
+ * cell, left to right and a row at a time:
+ *     ui_column Columns[] = {{UI_COLUMN_AUTO, 0}, {UI_COLUMN_FRACTION, 1}, {UI_COLUMN_FIXED, 80}};
+ *     UI_Columns(Ctx, 3, Columns);
+ *     UI_Text(Ctx, "Name", White); UI_Text(Ctx, Name, White); UI_Button(Ctx, "Edit");
+ *     UI_EndColumns(Ctx);
+ * Columns is copied. */
+void UI_Columns(ui_context *Ctx, int Count, ui_column *Columns);
+void UI_EndColumns(ui_context *Ctx);
+
+/* Parts of a frame that bench/ times on their own, not needed otherwise */
+int UI_UpdateInputState(ui_context *Ctx, ui_rect Rect, ui_id ID);
+void UI_OrderCommandRefs(ui_context *Ctx);
+
+#ifdef __cplusplus
+}
+
+UI_HASH_FUNCTION unsigned int
+UI_LiteralByte(const char *S, unsigned int Length, unsigned int i) {
+    return i < Length ? (unsigned char)S[i] : 0;
+}
+
+UI_HASH_FUNCTION unsigned int
+UI_LiteralSum(const char *S, unsigned int Length, unsigned int Index) {
+    return 4 * Index < Length ?
+        UI_HashWord(UI_LiteralByte(S, Length, 4 * Index) | UI_LiteralByte(S, Length, 4 * Index + 1) << 8 |
+                    UI_LiteralByte(S, Length, 4 * Index + 2) << 16 | UI_LiteralByte(S, Length, 4 * Index + 3) << 24,
+                    Index) + UI_LiteralSum(S, Length, Index + 1) : 0;
+}
+
+template<unsigned int N> constexpr ui_id
+UI_LiteralHash(const char (&S)[N]) {
+    return UI_HashFinalize(UI_LiteralSum(S, N - 1, 0), N - 1);
+}
+
+#define UI_ID(S) UI_LiteralHash("" S)
+#endif
 
 #endif
 
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ui_drawlist.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UI_DRAWLIST_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define UI_ABORT(Message) (fprintf(stderr, "UI_ASSERT: %s %s:%d \n", Message, \
+                                   __FILE__, __LINE__), exit(1))
+#define UI_ASSERT(X, Message) if(!(X)) { UI_ABORT(Message); }
+#define UI_MAX(X, Y) ((X > Y) ? X : Y)
+#define UI_MIN(X, Y) ((X < Y) ? X : Y)
+#define UI_INT_MAX 0x7fffffff
+
+typedef struct {
+    ui_rect Clip;
+#if UI_DRAWLIST_SSE2
+    __m128 ClipBounds; /* x0, y0, x1, y1 */
+    __m128 InvAtlasSize; /* 1 / w, 1 / h, 1 / w, 1 / h */
+#else
+    float ClipBounds[4];
+    float InvAtlasSize[4];
+#endif
+} ui_drawlist_state;
+
+/* Memory */
+
+void *
+UI_DrawListAllocate(ui_drawlist *List, size_t Size) {
+    void *Result = List->Alloc ? List->Alloc(Size) : malloc(Size);
+    UI_ASSERT(Result, "Out of memory");
+    return Result;
+}
+
+void
+UI_DrawListDeallocate(ui_drawlist *List, void *Memory) {
+    if(List->Free) {
+        List->Free(Memory);
+    } else {
+        free(Memory);
+    }
+}
+
+/* Makes room for QuadCount more quads. The index pattern only depends on the
+ * quad number so it's extended here and never rebuilt. */
+void
+UI_GrowDrawList(ui_drawlist *List, unsigned int QuadCount) {
+    unsigned int Needed = List->VertexCount + QuadCount * 4;
+    if(Needed <= List->VertexCapacity) {
+        return;
+    }
+    unsigned int Capacity = UI_MAX(4096, List->VertexCapacity * 2);
+    while(Capacity < Needed) {
+        Capacity *= 2;
+    }
+
+    ui_vertex *Vertices = UI_DrawListAllocate(List, Capacity * sizeof(ui_vertex));
+    unsigned int *Indices = UI_DrawListAllocate(List, Capacity / 4 * 6 * sizeof(unsigned int));
+    if(List->Vertices) {
+        memcpy(Vertices, List->Vertices, List->VertexCount * sizeof(ui_vertex));
+        memcpy(Indices, List->Indices, List->VertexCapacity / 4 * 6 * sizeof(unsigned int));
+        UI_DrawListDeallocate(List, List->Vertices);
+        UI_DrawListDeallocate(List, List->Indices);
+    }
+    for(unsigned int Quad = List->VertexCapacity / 4; Quad < Capacity / 4; Quad++) {
+        unsigned int *Index = Indices + Quad * 6;
+        unsigned int Vertex = Quad * 4;
+        Index[0] = Vertex;
+        Index[1] = Vertex + 1;
+        Index[2] = Vertex + 2;
+        Index[3] = Vertex + 1;
+        Index[4] = Vertex + 3;
+        Index[5] = Vertex + 2;
+    }
+    List->Vertices = Vertices;
+    List->Indices = Indices;
+    List->VertexCapacity = Capacity;
+}
+
+ui_draw_batch *
+UI_PushDrawBatch(ui_drawlist *List) {
+    if(List->BatchCount == List->BatchCapacity) {
+        unsigned int Capacity = UI_MAX(64, List->BatchCapacity * 2);
+        ui_draw_batch *Batches = UI_DrawListAllocate(List, Capacity * sizeof(ui_draw_batch));
+        if(List->Batches) {
+            memcpy(Batches, List->Batches, List->BatchCount * sizeof(ui_draw_batch));
+            UI_DrawListDeallocate(List, List->Batches);
+        }
+        List->Batches = Batches;
+        List->BatchCapacity = Capacity;
+    }
+    return &List->Batches[List->BatchCount++];
+}
+
+void
+UI_ReleaseDrawList(ui_drawlist *List) {
+    if(List->Vertices) {
+        UI_DrawListDeallocate(List, List->Vertices);
+        UI_DrawListDeallocate(List, List->Indices);
+    }
+    if(List->Batches) {
+        UI_DrawListDeallocate(List, List->Batches);
+    }
+    List->Vertices = 0;
+    List->Indices = 0;
+    List->Batches = 0;
+    List->VertexCount = List->VertexCapacity = List->IndexCount = 0;
+    List->BatchCount = List->BatchCapacity = 0;
+}
+
+/* Quads */
+
+ui_rect
+UI_DrawListIntersect(ui_rect A, ui_rect B) {
+    int MaxX = UI_MIN(A.x + A.w, B.x + B.w);
+    int MaxY = UI_MIN(A.y + A.h, B.y + B.h);
+    ui_rect Result;
+    Result.x = UI_MAX(A.x, B.x);
+    Result.y = UI_MAX(A.y, B.y);
+    Result.w = UI_MAX(0, MaxX - Result.x);
+    Result.h = UI_MAX(0, MaxY - Result.y);
+    return Result;
+}
+
+void
+UI_SetDrawListClip(ui_drawlist_state *State, ui_rect Clip) {
+    State->Clip = Clip;
+#if UI_DRAWLIST_SSE2
+    State->ClipBounds = _mm_cvtepi32_ps(_mm_setr_epi32(Clip.x, Clip.y, Clip.x + Clip.w, Clip.y + Clip.h));
+#else
+    State->ClipBounds[0] = Clip.x;
+    State->ClipBounds[1] = Clip.y;
+    State->ClipBounds[2] = Clip.x + Clip.w;
+    State->ClipBounds[3] = Clip.y + Clip.h;
+#endif
+}
+
+/* Clips Dest to the current clip rect, maps what's left of it into the source
+ * rect and writes the four vertices of the quad, in the order
+ * (x1, y1), (x0, y1), (x1, y0), (x0, y0). Returns 0 if nothing is left. */
+int
+UI_ClipQuad(ui_vertex *Out, ui_drawlist_state *State, ui_rect Dest, ui_rect Src, ui_color Color) {
+#if UI_DRAWLIST_SSE2
+    __m128 P = _mm_cvtepi32_ps(_mm_setr_epi32(Dest.x, Dest.y, Dest.x + Dest.w, Dest.y + Dest.h));
+    __m128 UV = _mm_mul_ps(_mm_cvtepi32_ps(_mm_setr_epi32(Src.x, Src.y, Src.x + Src.w, Src.y + Src.h)),
+                           State->InvAtlasSize);
+
+    /* Lower corner takes the max, upper corner the min */
+    __m128 Lo = _mm_max_ps(P, State->ClipBounds);
+    __m128 Hi = _mm_min_ps(P, State->ClipBounds);
+    __m128 C = _mm_shuffle_ps(Lo, Hi, _MM_SHUFFLE(3, 2, 1, 0));
+    if((_mm_movemask_ps(_mm_cmplt_ps(C, _mm_movehl_ps(C, C))) & 3) != 3) {
+        return 0;
+    }
+
+    __m128 P0 = _mm_movelh_ps(P, P);
+    __m128 UV0 = _mm_movelh_ps(UV, UV);
+    __m128 T = _mm_div_ps(_mm_sub_ps(C, P0), _mm_sub_ps(_mm_movehl_ps(P, P), P0));
+    UV = _mm_add_ps(UV0, _mm_mul_ps(T, _mm_sub_ps(_mm_movehl_ps(UV, UV), UV0)));
+
+    _mm_storeu_ps(&Out[0].x, _mm_shuffle_ps(C, UV, _MM_SHUFFLE(3, 2, 3, 2)));
+    _mm_storeu_ps(&Out[1].x, _mm_shuffle_ps(C, UV, _MM_SHUFFLE(3, 0, 3, 0)));
+    _mm_storeu_ps(&Out[2].x, _mm_shuffle_ps(C, UV, _MM_SHUFFLE(1, 2, 1, 2)));
+    _mm_storeu_ps(&Out[3].x, _mm_shuffle_ps(C, UV, _MM_SHUFFLE(1, 0, 1, 0)));
+#else
+    float P[4] = {Dest.x, Dest.y, Dest.x + Dest.w, Dest.y + Dest.h};
+    float UV[4] = {Src.x * State->InvAtlasSize[0], Src.y * State->InvAtlasSize[1],
+                   (Src.x + Src.w) * State->InvAtlasSize[2], (Src.y + Src.h) * State->InvAtlasSize[3]};
+    float C[4];
+    C[0] = UI_MAX(P[0], State->ClipBounds[0]);
+    C[1] = UI_MAX(P[1], State->ClipBounds[1]);
+    C[2] = UI_MIN(P[2], State->ClipBounds[2]);
+    C[3] = UI_MIN(P[3], State->ClipBounds[3]);
+    if(!(C[0] < C[2] && C[1] < C[3])) {
+        return 0;
+    }
+
+    float U[4];
+    for(int i = 0; i < 4; i++) {
+        int Axis = i & 1;
+        U[i] = UV[Axis] + (C[i] - P[Axis]) / (P[Axis + 2] - P[Axis]) * (UV[Axis + 2] - UV[Axis]);
+    }
+
+    Out[0].x = C[2]; Out[0].y = C[3]; Out[0].u = U[2]; Out[0].v = U[3];
+    Out[1].x = C[0]; Out[1].y = C[3]; Out[1].u = U[0]; Out[1].v = U[3];
+    Out[2].x = C[2]; Out[2].y = C[1]; Out[2].u = U[2]; Out[2].v = U[1];
+    Out[3].x = C[0]; Out[3].y = C[1]; Out[3].u = U[0]; Out[3].v = U[1];
+#endif
+    Out[0].Color = Color;
+    Out[1].Color = Color;
+    Out[2].Color = Color;
+    Out[3].Color = Color;
+    return 1;
+}
+
+void
+UI_PushQuad(ui_drawlist *List, ui_drawlist_state *State, ui_rect Dest, ui_rect Src, ui_color Color) {
+    if(List->VertexCount + 4 > List->VertexCapacity) {
+        UI_GrowDrawList(List, 1);
+    }
+    if(UI_ClipQuad(List->Vertices + List->VertexCount, State, Dest, Src, Color)) {
+        /* Quads with the same clip rect go in the same batch */
+        ui_draw_batch *Batch = List->BatchCount ? &List->Batches[List->BatchCount - 1] : 0;
+        if(!Batch || Batch->Clip.x != State->Clip.x || Batch->Clip.y != State->Clip.y ||
+           Batch->Clip.w != State->Clip.w || Batch->Clip.h != State->Clip.h) {
+            Batch = UI_PushDrawBatch(List);
+            Batch->Clip = State->Clip;
+            Batch->IndexOffset = List->IndexCount;
+            Batch->IndexCount = 0;
+        }
+        Batch->IndexCount += 6;
+        List->IndexCount += 6;
+        List->VertexCount += 4;
+    }
+}
+
+/* Build */
+
+void
+UI_PushGlyphs(ui_drawlist *List, ui_drawlist_state *State, ui_glyph_cache *Cache, ui_command_text *Text) {
+    int x = Text->Rect.x;
+    char *End = Text->Text + Text->Length;
+    for(char *C = Text->Text; C < End;) {
+        unsigned int Codepoint = (unsigned char)*C;
+        if(Codepoint < 128) {
+            C++;
+        } else {
+            C += UI_DecodeUTF8(C, End, &Codepoint);
+        }
+        ui_glyph *Glyph = UI_GetGlyph(Cache, Codepoint);
+        if(Glyph && Glyph->Missing) {
+            Glyph = UI_GetGlyph(Cache, Cache->Fallback);
+        }
+        if(!Glyph || Glyph->Missing) {
+            continue;
+        }
+        if(Glyph->Rect.w > 0 && Glyph->Rect.h > 0) {
+            ui_rect Dest = UI_Rect(x + Glyph->OffsetX, Text->Rect.y + Glyph->OffsetY, Glyph->Rect.w, Glyph->Rect.h);
+            UI_PushQuad(List, State, Dest, Glyph->Rect, Text->Color);
+        }
+        x += Glyph->Advance;
+    }
+}
+
+void
+UI_BuildDrawList(ui_context *Ctx, ui_drawlist *List, ui_draw_metrics *Metrics) {
+    ui_drawlist_state State;
+    float InvWidth = 1.f / Metrics->AtlasWidth;
+    float InvHeight = 1.f / Metrics->AtlasHeight;
+#if UI_DRAWLIST_SSE2
+    State.InvAtlasSize = _mm_setr_ps(InvWidth, InvHeight, InvWidth, InvHeight);
+#else
+    State.InvAtlasSize[0] = State.InvAtlasSize[2] = InvWidth;
+    State.InvAtlasSize[1] = State.InvAtlasSize[3] = InvHeight;
+#endif
+
+    ui_rect Root = (Ctx->Viewport.w > 0 && Ctx->Viewport.h > 0) ? Ctx->Viewport :
+        UI_Rect(-UI_INT_MAX / 2, -UI_INT_MAX / 2, UI_INT_MAX, UI_INT_MAX);
+    ui_rect ClipStack[UI_CLIP_STACK_MAX];
+    int ClipTop;
+
+    List->VertexCount = 0;
+    List->IndexCount = 0;
+    List->BatchCount = 0;
+    if(Metrics->GlyphCache) {
+        UI_BeginGlyphFrame(Metrics->GlyphCache);
+    }
+
+    for(unsigned int i = 0; i < Ctx->CommandRefStack.Index; i++) {
+        ui_command_block *Block = Ctx->CommandRefStack.Items[i].Target;
+        UI_GrowDrawList(List, Block->TypeCount[UI_COMMAND_RECT] + Block->TypeCount[UI_COMMAND_ICON]);
+
+        ClipTop = 0;
+        ClipStack[0] = Root;
+        UI_SetDrawListClip(&State, Root);
+        for(ui_command *Cmd = UI_BLOCK_BEGIN(Block); Cmd < UI_BLOCK_END(Block); Cmd = UI_NEXT_COMMAND(Cmd)) {
+            switch(Cmd->Type) {
+                case UI_COMMAND_PUSH_CLIP: {
+                    UI_ASSERT(ClipTop + 1 < UI_CLIP_STACK_MAX, "Clip stack is full");
+                    ClipStack[ClipTop + 1] = UI_DrawListIntersect(Cmd->Clip.Rect, ClipStack[ClipTop]);
+                    ClipTop++;
+                    UI_SetDrawListClip(&State, ClipStack[ClipTop]);
+                } break;
+                case UI_COMMAND_POP_CLIP: {
+                    ClipTop--;
+                    UI_SetDrawListClip(&State, ClipStack[ClipTop]);
+                } break;
+                case UI_COMMAND_CLIP: {
+                    UI_SetDrawListClip(&State, Cmd->Clip.Rect);
+                } break;
+                case UI_COMMAND_RECT: {
+                    UI_PushQuad(List, &State, Cmd->Rect.Rect, Metrics->White, Cmd->Rect.Color);
+                } break;
+                case UI_COMMAND_ICON: {
+                    UI_PushQuad(List, &State, Cmd->Icon.Rect, Metrics->Icons[Cmd->Icon.ID], Cmd->Icon.Color);
+                } break;
+                case UI_COMMAND_TEXT: {
+                    if(Metrics->GlyphCache) {
+                        UI_PushGlyphs(List, &State, Metrics->GlyphCache, &Cmd->Text);
+                        break;
+                    }
+                    int x = Cmd->Text.Rect.x;
+                    for(char *C = Cmd->Text.Text; C < Cmd->Text.Text + Cmd->Text.Length; C++) {
+                        int Glyph = (unsigned char)*C < 128 ? *C : '?';
+                        ui_rect Src = Metrics->Glyphs[Glyph];
+                        if(Src.w > 0 && Src.h > 0) {
+                            UI_PushQuad(List, &State, UI_Rect(x, Cmd->Text.Rect.y, Src.w, Src.h), Src, Cmd->Text.Color);
+                        }
+                        x += Metrics->Advance[Glyph];
+                    }
+                } break;
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef ui_drawlist_h
+#define ui_drawlist_h
+
+#include "ui.h"
+#include "ui_glyphcache.h"
+
+/* Turns the commands of a frame into vertices ready for the GPU. Every rect,
+ * glyph and icon becomes a quad of four vertices, the indices of the quads
+ * follow a fixed pattern and are only built when the vertex buffer grows:
+ *     4q + 0, 4q + 1, 4q + 2, 4q + 1, 4q + 3, 4q + 2
+ * Quads are clipped on the CPU and split into batches of quads sharing a clip
+ * rect, so each batch can be drawn with a single draw call and scissor rect. */
+
+typedef struct {
+    float x, y;
+    float u, v;
+    ui_color Color;
+} ui_vertex;
+
+typedef struct {
+    ui_rect Clip;
+    unsigned int IndexOffset; /* First index of the batch */
+    unsigned int IndexCount;
+} ui_draw_batch;
+
+/* Source rects are in atlas pixels. Glyphs are indexed by character, glyphs
+ * with an empty source rect only advance the pen. If GlyphCache is set text
+ * is decoded as UTF-8 and drawn with the glyphs of the cache instead, the
+ * cache has to use the same atlas. */
+typedef struct {
+    int AtlasWidth, AtlasHeight;
+    ui_rect White; /* Solid white texels, used for rects */
+    ui_rect Icons[3]; /* Indexed by UI_ICON_* */
+    ui_rect Glyphs[128];
+    int Advance[128];
+    ui_glyph_cache *GlyphCache;
+} ui_draw_metrics;
+
+typedef struct {
+    /* malloc and free are used if not set */
+    void *(* Alloc)(size_t Size);
+    void (* Free)(void *Memory);
+
+    ui_vertex *Vertices;
+    unsigned int VertexCount, VertexCapacity;
+
+    /* IndexCapacity is always VertexCapacity / 4 * 6 */
+    unsigned int *Indices;
+    unsigned int IndexCount;
+
+    ui_draw_batch *Batches;
+    unsigned int BatchCount, BatchCapacity;
+} ui_drawlist;
+
+/* Starts a frame of the glyph cache if there is one, its dirty rects have to
+ * be uploaded before the draw list is drawn */
+void UI_BuildDrawList(ui_context *Ctx, ui_drawlist *List, ui_draw_metrics *Metrics);
+void UI_ReleaseDrawList(ui_drawlist *List);
+
+#endif
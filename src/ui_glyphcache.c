@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ui_glyphcache.h"
+
+#define UI_ABORT(Message) (fprintf(stderr, "UI_ASSERT: %s %s:%d \n", Message, \
+                                   __FILE__, __LINE__), exit(1))
+#define UI_ASSERT(X, Message) if(!(X)) { UI_ABORT(Message); }
+#define UI_MAX(X, Y) ((X > Y) ? X : Y)
+#define UI_MIN(X, Y) ((X < Y) ? X : Y)
+#define UI_INT_MAX 0x7fffffff
+
+/* UTF-8 */
+
+int
+UI_DecodeUTF8(char *Text, char *End, unsigned int *Codepoint) {
+    unsigned char *At = (unsigned char *)Text;
+    if(At[0] < 0x80) {
+        *Codepoint = At[0];
+        return 1;
+    }
+
+    /* Smallest codepoint of each length, anything below is an overlong encoding */
+    static const unsigned int Min[] = {0, 0, 0x80, 0x800, 0x10000};
+    int Length = (At[0] >= 0xf0) ? 4 : (At[0] >= 0xe0) ? 3 : (At[0] >= 0xc0) ? 2 : 0;
+    if(Length && At[0] < 0xf8 && End - Text >= Length) {
+        unsigned int Result = At[0] & (0x7f >> Length);
+        int i = 1;
+        for(; i < Length && (At[i] & 0xc0) == 0x80; i++) {
+            Result = Result << 6 | (At[i] & 0x3f);
+        }
+        if(i == Length && Result >= Min[Length] && Result <= 0x10ffff &&
+           (Result < 0xd800 || Result > 0xdfff)) {
+            *Codepoint = Result;
+            return Length;
+        }
+    }
+    *Codepoint = 0xfffd;
+    return 1;
+}
+
+/* Memory */
+
+void *
+UI_GlyphCacheAllocate(ui_glyph_cache *Cache, size_t Size) {
+    void *Result = Cache->Alloc ? Cache->Alloc(Size) : malloc(Size);
+    UI_ASSERT(Result, "Out of memory");
+    memset(Result, 0, Size);
+    return Result;
+}
+
+void
+UI_GlyphCacheDeallocate(ui_glyph_cache *Cache, void *Memory) {
+    if(Cache->Free) {
+        Cache->Free(Memory);
+    } else {
+        free(Memory);
+    }
+}
+
+void
+UI_InitGlyphCache(ui_glyph_cache *Cache) {
+    UI_ASSERT(Cache->AtlasWidth > 0 && Cache->AtlasHeight > 0, "Glyph cache has no atlas size");
+    UI_ASSERT(Cache->GlyphSize && Cache->Rasterize, "Glyph cache has no rasterizer");
+    if(!Cache->GlyphCapacity) {
+        Cache->GlyphCapacity = 1024;
+    }
+    if(!Cache->Fallback) {
+        Cache->Fallback = '?';
+    }
+
+    Cache->Pixels = UI_GlyphCacheAllocate(Cache, (size_t)Cache->AtlasWidth * Cache->AtlasHeight);
+    Cache->Glyphs = UI_GlyphCacheAllocate(Cache, Cache->GlyphCapacity * sizeof(ui_glyph));
+    for(int i = 0; i < Cache->GlyphCapacity; i++) {
+        Cache->Glyphs[i].Next = (i + 1 < Cache->GlyphCapacity) ? &Cache->Glyphs[i + 1] : 0;
+    }
+    Cache->FreeGlyphs = Cache->Glyphs;
+
+    Cache->SlotCount = 64;
+    while(Cache->SlotCount < 2 * (unsigned int)Cache->GlyphCapacity) {
+        Cache->SlotCount *= 2;
+    }
+    Cache->Slots = UI_GlyphCacheAllocate(Cache, Cache->SlotCount * sizeof(ui_glyph *));
+
+    /* Every node is at least a pixel wide, one more for the node being inserted */
+    Cache->Nodes = UI_GlyphCacheAllocate(Cache, (Cache->AtlasWidth + 2) * sizeof(ui_skyline_node));
+    Cache->BaseNodes = UI_GlyphCacheAllocate(Cache, (Cache->AtlasWidth + 2) * sizeof(ui_skyline_node));
+    Cache->Nodes[0].w = Cache->AtlasWidth;
+    Cache->NodeCount = 1;
+    Cache->BaseNodes[0] = Cache->Nodes[0];
+    Cache->BaseNodeCount = 1;
+}
+
+void
+UI_ReleaseGlyphCache(ui_glyph_cache *Cache) {
+    if(Cache->Pixels) {
+        UI_GlyphCacheDeallocate(Cache, Cache->Pixels);
+        UI_GlyphCacheDeallocate(Cache, Cache->Glyphs);
+        UI_GlyphCacheDeallocate(Cache, Cache->Slots);
+        UI_GlyphCacheDeallocate(Cache, Cache->Nodes);
+        UI_GlyphCacheDeallocate(Cache, Cache->BaseNodes);
+    }
+    Cache->Pixels = 0;
+    Cache->Glyphs = Cache->FreeGlyphs = Cache->First = Cache->Last = 0;
+    memset(Cache->ASCII, 0, sizeof(Cache->ASCII));
+    Cache->Slots = 0;
+    Cache->SlotCount = 0;
+    Cache->Nodes = Cache->BaseNodes = 0;
+    Cache->NodeCount = Cache->BaseNodeCount = 0;
+    Cache->DirtyCount = 0;
+    Cache->Overflowed = 0;
+}
+
+/* Skyline */
+
+/* Returns the y a rect would be placed at if its left edge is on node Index,
+ * or -1 if it doesn't fit there */
+int
+UI_SkylineFit(ui_glyph_cache *Cache, int Index, int Width, int Height) {
+    if(Cache->Nodes[Index].x + Width > Cache->AtlasWidth) {
+        return -1;
+    }
+    int y = 0;
+    for(int i = Index, Left = Width; Left > 0; i++) {
+        y = UI_MAX(y, Cache->Nodes[i].y);
+        if(y + Height > Cache->AtlasHeight) {
+            return -1;
+        }
+        Left -= Cache->Nodes[i].w;
+    }
+    return y;
+}
+
+/* Places the rect where its top is lowest, on the narrowest node if there's
+ * a tie, and raises the skyline under it */
+int
+UI_SkylinePack(ui_glyph_cache *Cache, int Width, int Height, ui_rect *Rect) {
+    int Best = -1, BestY = 0, BestTop = UI_INT_MAX, BestWidth = UI_INT_MAX;
+    for(int i = 0; i < Cache->NodeCount; i++) {
+        int y = UI_SkylineFit(Cache, i, Width, Height);
+        if(y >= 0 && (y + Height < BestTop || (y + Height == BestTop && Cache->Nodes[i].w < BestWidth))) {
+            Best = i;
+            BestY = y;
+            BestTop = y + Height;
+            BestWidth = Cache->Nodes[i].w;
+        }
+    }
+    if(Best < 0) {
+        return 0;
+    }
+
+    ui_skyline_node *Nodes = Cache->Nodes;
+    int x = Nodes[Best].x;
+    memmove(Nodes + Best + 1, Nodes + Best, (Cache->NodeCount - Best) * sizeof(ui_skyline_node));
+    Nodes[Best].x = x;
+    Nodes[Best].y = BestTop;
+    Nodes[Best].w = Width;
+    Cache->NodeCount++;
+
+    /* Cut the nodes that are now under the rect */
+    for(int i = Best + 1; i < Cache->NodeCount;) {
+        int Covered = x + Width - Nodes[i].x;
+        if(Covered <= 0) {
+            break;
+        }
+        if(Covered < Nodes[i].w) {
+            Nodes[i].x += Covered;
+            Nodes[i].w -= Covered;
+            break;
+        }
+        memmove(Nodes + i, Nodes + i + 1, (Cache->NodeCount - i - 1) * sizeof(ui_skyline_node));
+        Cache->NodeCount--;
+    }
+
+    for(int i = 0; i + 1 < Cache->NodeCount;) {
+        if(Nodes[i].y == Nodes[i + 1].y) {
+            Nodes[i].w += Nodes[i + 1].w;
+            memmove(Nodes + i + 1, Nodes + i + 2, (Cache->NodeCount - i - 2) * sizeof(ui_skyline_node));
+            Cache->NodeCount--;
+        } else {
+            i++;
+        }
+    }
+
+    *Rect = UI_Rect(x, BestY, Width, Height);
+    return 1;
+}
+
+int
+UI_ReserveGlyphRect(ui_glyph_cache *Cache, int Width, int Height, ui_rect *Rect) {
+    if(!Cache->Pixels) {
+        UI_InitGlyphCache(Cache);
+    }
+    UI_ASSERT(!Cache->First, "Rects have to be reserved before the first glyph");
+    /* Padded like glyphs so filtering doesn't blend them */
+    if(!UI_SkylinePack(Cache, Width + 1, Height + 1, Rect)) {
+        return 0;
+    }
+    Rect->w = Width;
+    Rect->h = Height;
+    memcpy(Cache->BaseNodes, Cache->Nodes, Cache->NodeCount * sizeof(ui_skyline_node));
+    Cache->BaseNodeCount = Cache->NodeCount;
+    return 1;
+}
+
+/* Glyphs */
+
+unsigned int
+UI_HashCodepoint(unsigned int Codepoint) {
+    return Codepoint * 2654435761u;
+}
+
+/* Returns the slot of Codepoint in the index, or the empty slot it would go in */
+ui_glyph **
+UI_GlyphSlot(ui_glyph_cache *Cache, unsigned int Codepoint) {
+    if(Codepoint < 128) {
+        return &Cache->ASCII[Codepoint];
+    }
+    unsigned int Mask = Cache->SlotCount - 1;
+    unsigned int i = UI_HashCodepoint(Codepoint) & Mask;
+    while(Cache->Slots[i] && Cache->Slots[i]->Codepoint != Codepoint) {
+        i = (i + 1) & Mask;
+    }
+    return &Cache->Slots[i];
+}
+
+/* Removes the glyph in Slot from the index. The glyphs after it in the same
+ * run of slots move back if the gap is between them and their home slot. */
+void
+UI_RemoveGlyphSlot(ui_glyph_cache *Cache, ui_glyph **Slot) {
+    if(Slot >= Cache->ASCII && Slot < Cache->ASCII + 128) {
+        *Slot = 0;
+        return;
+    }
+    unsigned int Mask = Cache->SlotCount - 1;
+    unsigned int Gap = (unsigned int)(Slot - Cache->Slots);
+    for(unsigned int i = (Gap + 1) & Mask; Cache->Slots[i]; i = (i + 1) & Mask) {
+        unsigned int Home = UI_HashCodepoint(Cache->Slots[i]->Codepoint) & Mask;
+        if(((i - Home) & Mask) >= ((i - Gap) & Mask)) {
+            Cache->Slots[Gap] = Cache->Slots[i];
+            Gap = i;
+        }
+    }
+    Cache->Slots[Gap] = 0;
+}
+
+void
+UI_UnlinkGlyph(ui_glyph_cache *Cache, ui_glyph *Glyph) {
+    if(Glyph->Prev) {
+        Glyph->Prev->Next = Glyph->Next;
+    } else {
+        Cache->First = Glyph->Next;
+    }
+    if(Glyph->Next) {
+        Glyph->Next->Prev = Glyph->Prev;
+    } else {
+        Cache->Last = Glyph->Prev;
+    }
+}
+
+void
+UI_LinkGlyphFirst(ui_glyph_cache *Cache, ui_glyph *Glyph) {
+    Glyph->Prev = 0;
+    Glyph->Next = Cache->First;
+    if(Cache->First) {
+        Cache->First->Prev = Glyph;
+    } else {
+        Cache->Last = Glyph;
+    }
+    Cache->First = Glyph;
+}
+
+void
+UI_EvictGlyph(ui_glyph_cache *Cache, ui_glyph *Glyph) {
+    UI_RemoveGlyphSlot(Cache, UI_GlyphSlot(Cache, Glyph->Codepoint));
+    UI_UnlinkGlyph(Cache, Glyph);
+    Glyph->Next = Cache->FreeGlyphs;
+    Cache->FreeGlyphs = Glyph;
+    Cache->EvictedCount++;
+}
+
+/* Drops every glyph, the skyline goes back to only the reserved rects */
+void
+UI_FlushGlyphs(ui_glyph_cache *Cache) {
+    while(Cache->First) {
+        UI_EvictGlyph(Cache, Cache->First);
+    }
+    memcpy(Cache->Nodes, Cache->BaseNodes, Cache->BaseNodeCount * sizeof(ui_skyline_node));
+    Cache->NodeCount = Cache->BaseNodeCount;
+    Cache->FlushCount++;
+}
+
+void
+UI_BeginGlyphFrame(ui_glyph_cache *Cache) {
+    if(!Cache->Pixels) {
+        UI_InitGlyphCache(Cache);
+    }
+    Cache->Frame++;
+    if(Cache->Overflowed) {
+        UI_FlushGlyphs(Cache);
+        Cache->Overflowed = 0;
+    }
+    Cache->DirtyCount = 0;
+    Cache->HitCount = 0;
+    Cache->MissCount = 0;
+    Cache->EvictedCount = 0;
+    Cache->FailedCount = 0;
+}
+
+void
+UI_AddDirtyRect(ui_glyph_cache *Cache, ui_rect Rect) {
+    if(Cache->DirtyCount) {
+        /* Glyphs packed side by side on the same row extend the last rect */
+        ui_rect *Last = &Cache->Dirty[Cache->DirtyCount - 1];
+        if(Last->y == Rect.y && Last->h == Rect.h && Last->x + Last->w == Rect.x) {
+            Last->w += Rect.w;
+            return;
+        }
+    }
+    if(Cache->DirtyCount == UI_GLYPH_DIRTY_MAX) {
+        int MinX = Rect.x, MinY = Rect.y, MaxX = Rect.x + Rect.w, MaxY = Rect.y + Rect.h;
+        for(int i = 0; i < Cache->DirtyCount; i++) {
+            ui_rect R = Cache->Dirty[i];
+            MinX = UI_MIN(MinX, R.x);
+            MinY = UI_MIN(MinY, R.y);
+            MaxX = UI_MAX(MaxX, R.x + R.w);
+            MaxY = UI_MAX(MaxY, R.y + R.h);
+        }
+        Cache->Dirty[0] = UI_Rect(MinX, MinY, MaxX - MinX, MaxY - MinY);
+        Cache->DirtyCount = 1;
+        return;
+    }
+    Cache->Dirty[Cache->DirtyCount++] = Rect;
+}
+
+/* Finds room for a Width x Height glyph and its padding, first on the
+ * skyline, then in the rect of the least recently drawn glyph that is large
+ * enough. Glyphs drawn this frame are kept. */
+int
+UI_PlaceGlyph(ui_glyph_cache *Cache, int Width, int Height, ui_rect *Rect) {
+    if(UI_SkylinePack(Cache, Width + 1, Height + 1, Rect)) {
+        Rect->w = Width;
+        Rect->h = Height;
+        return 1;
+    }
+    for(ui_glyph *Glyph = Cache->Last; Glyph && Glyph->Frame != Cache->Frame; Glyph = Glyph->Prev) {
+        if(Glyph->Rect.w >= Width && Glyph->Rect.h >= Height) {
+            *Rect = UI_Rect(Glyph->Rect.x, Glyph->Rect.y, Width, Height);
+            UI_EvictGlyph(Cache, Glyph);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+ui_glyph *
+UI_GetGlyph(ui_glyph_cache *Cache, unsigned int Codepoint) {
+    if(!Cache->Pixels) {
+        UI_InitGlyphCache(Cache);
+    }
+    ui_glyph **Slot = UI_GlyphSlot(Cache, Codepoint);
+    ui_glyph *Glyph = *Slot;
+    if(Glyph) {
+        Cache->HitCount++;
+        if(Glyph->Frame != Cache->Frame) {
+            UI_UnlinkGlyph(Cache, Glyph);
+            UI_LinkGlyphFirst(Cache, Glyph);
+            Glyph->Frame = Cache->Frame;
+        }
+        return Glyph;
+    }
+    Cache->MissCount++;
+
+    ui_glyph_metrics Metrics = {0};
+    int Missing = !Cache->GlyphSize(Cache->User, Codepoint, &Metrics);
+    int HasPixels = !Missing && Metrics.Width > 0 && Metrics.Height > 0;
+    ui_rect Rect = UI_Rect(0, 0, 0, 0);
+    if(HasPixels && !UI_PlaceGlyph(Cache, Metrics.Width, Metrics.Height, &Rect)) {
+        /* The glyph is kept without pixels until the flush of the next frame */
+        Cache->FailedCount++;
+        Cache->Overflowed = 1;
+        HasPixels = 0;
+    }
+
+    if(!Cache->FreeGlyphs) {
+        if(!Cache->Last || Cache->Last->Frame == Cache->Frame) {
+            Cache->FailedCount++;
+            Cache->Overflowed = 1;
+            return 0;
+        }
+        UI_EvictGlyph(Cache, Cache->Last);
+    }
+    Glyph = Cache->FreeGlyphs;
+    Cache->FreeGlyphs = Glyph->Next;
+    Glyph->Codepoint = Codepoint;
+    Glyph->Rect = Rect;
+    Glyph->OffsetX = Metrics.OffsetX;
+    Glyph->OffsetY = Metrics.OffsetY;
+    Glyph->Advance = Metrics.Advance;
+    Glyph->Missing = Missing;
+    Glyph->Frame = Cache->Frame;
+    UI_LinkGlyphFirst(Cache, Glyph);
+    /* Evicting may have moved glyphs in the index */
+    *UI_GlyphSlot(Cache, Codepoint) = Glyph;
+
+    if(HasPixels) {
+        ui_rect Padded = UI_Rect(Rect.x, Rect.y, UI_MIN(Rect.w + 1, Cache->AtlasWidth - Rect.x),
+                                 UI_MIN(Rect.h + 1, Cache->AtlasHeight - Rect.y));
+        unsigned char *Pixels = Cache->Pixels + Rect.y * Cache->AtlasWidth + Rect.x;
+        for(int y = 0; y < Padded.h; y++) {
+            memset(Pixels + y * Cache->AtlasWidth, 0, Padded.w);
+        }
+        Cache->Rasterize(Cache->User, Codepoint, Pixels, Cache->AtlasWidth);
+        UI_AddDirtyRect(Cache, Padded);
+    }
+    return Glyph;
+}
+
+/* Advance of a codepoint without rasterizing it, glyphs the font doesn't
+ * have are measured as Fallback */
+int
+UI_GlyphAdvance(ui_glyph_cache *Cache, unsigned int Codepoint) {
+    for(int Tries = 0; Tries < 2; Tries++) {
+        ui_glyph *Glyph = *UI_GlyphSlot(Cache, Codepoint);
+        if(Glyph && !Glyph->Missing) {
+            return Glyph->Advance;
+        }
+        ui_glyph_metrics Metrics = {0};
+        if(!Glyph && Cache->GlyphSize(Cache->User, Codepoint, &Metrics)) {
+            return Metrics.Advance;
+        }
+        Codepoint = Cache->Fallback;
+    }
+    return 0;
+}
+
+int
+UI_MeasureGlyphs(ui_glyph_cache *Cache, char *Text, int Length) {
+    if(!Cache->Pixels) {
+        UI_InitGlyphCache(Cache);
+    }
+    int Width = 0;
+    char *End = Text + Length;
+    for(char *C = Text; C < End;) {
+        unsigned int Codepoint = (unsigned char)*C;
+        if(Codepoint < 128) {
+            C++;
+        } else {
+            C += UI_DecodeUTF8(C, End, &Codepoint);
+        }
+        Width += UI_GlyphAdvance(Cache, Codepoint);
+    }
+    return Width;
+}
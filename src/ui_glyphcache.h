@@ -0,0 +1,114 @@
+#ifndef ui_glyphcache_h
+#define ui_glyphcache_h
+
+#include "ui.h"
+
+/* Keeps the glyphs of UTF-8 text in an atlas of 8-bit coverage values. Glyphs
+ * are rasterized by the user when they're first drawn and packed with a
+ * skyline packer. When the atlas or the glyphs are full, the glyph used
+ * longest ago makes room: the new glyph takes its rect if it fits. Glyphs
+ * drawn in the current frame are never evicted, if a glyph can't be placed it
+ * is not drawn and the whole atlas is flushed at the start of the next frame.
+ * The atlas rects written in a frame are listed in Dirty so only those have
+ * to be uploaded. */
+
+#define UI_GLYPH_DIRTY_MAX 32
+
+/* Filled in by GlyphSize. The glyph is drawn Width x Height pixels at
+ * (OffsetX, OffsetY) from the bottom left of the text rect. */
+typedef struct {
+    int Width, Height;
+    int OffsetX, OffsetY;
+    int Advance;
+} ui_glyph_metrics;
+
+/* Rect is in the atlas and empty for glyphs without pixels, e.g. space.
+ * Missing is set if the font has no glyph for the codepoint, the fallback
+ * glyph is drawn instead. Frame is the last frame the glyph was drawn in,
+ * Prev and Next link the glyphs from the most to the least recently drawn. */
+typedef struct ui_glyph {
+    unsigned int Codepoint;
+    ui_rect Rect;
+    int OffsetX, OffsetY;
+    int Advance;
+    int Missing;
+    unsigned int Frame;
+    struct ui_glyph *Prev, *Next;
+} ui_glyph;
+
+typedef struct {
+    int x, y, w;
+} ui_skyline_node;
+
+typedef struct {
+    /* Set by the user. GlyphCapacity defaults to 1024 and Fallback to '?'. */
+    int AtlasWidth, AtlasHeight;
+    int GlyphCapacity;
+    unsigned int Fallback;
+    void *User;
+    /* Returns 0 if the font has no glyph for Codepoint */
+    int (* GlyphSize)(void *User, unsigned int Codepoint, ui_glyph_metrics *Metrics);
+    /* Writes the Width x Height coverage values of the glyph, starting at its
+     * bottom row. Rows are Stride bytes apart. */
+    void (* Rasterize)(void *User, unsigned int Codepoint, unsigned char *Pixels, int Stride);
+    /* malloc and free are used if not set */
+    void *(* Alloc)(size_t Size);
+    void (* Free)(void *Memory);
+
+    /* AtlasWidth x AtlasHeight coverage values, row y of the atlas starts at
+     * Pixels + y * AtlasWidth */
+    unsigned char *Pixels;
+
+    /* Atlas rects written since UI_BeginGlyphFrame. When there are more than
+     * UI_GLYPH_DIRTY_MAX they're merged into their bounding box. */
+    ui_rect Dirty[UI_GLYPH_DIRTY_MAX];
+    int DirtyCount;
+
+    /* Glyphs holds GlyphCapacity glyphs, FreeGlyphs the ones not in use. ASCII
+     * glyphs are found by their codepoint, the others in Slots with open
+     * addressing, SlotCount is a power of two and at least twice
+     * GlyphCapacity. */
+    ui_glyph *Glyphs;
+    ui_glyph *FreeGlyphs;
+    ui_glyph *First, *Last;
+    ui_glyph *ASCII[128];
+    ui_glyph **Slots;
+    unsigned int SlotCount;
+
+    /* Nodes is the skyline, BaseNodes the skyline with only the reserved
+     * rects that survive a flush */
+    ui_skyline_node *Nodes, *BaseNodes;
+    int NodeCount, BaseNodeCount;
+
+    unsigned int Frame;
+    int Overflowed;
+
+    /* Reset in UI_BeginGlyphFrame */
+    unsigned int HitCount, MissCount, EvictedCount, FailedCount;
+    unsigned int FlushCount; /* Not reset */
+} ui_glyph_cache;
+
+/* Decodes the codepoint at Text, returns the number of bytes it takes.
+ * Invalid or truncated sequences decode to U+FFFD one byte at a time. */
+int UI_DecodeUTF8(char *Text, char *End, unsigned int *Codepoint);
+
+/* Reserves a rect in the atlas that's never evicted, e.g. for solid white
+ * texels or icons. Only before the first glyph. Returns 0 if it doesn't fit. */
+int UI_ReserveGlyphRect(ui_glyph_cache *Cache, int Width, int Height, ui_rect *Rect);
+
+/* Starts a frame of drawing glyphs, UI_BuildDrawList calls it if the metrics
+ * have a glyph cache */
+void UI_BeginGlyphFrame(ui_glyph_cache *Cache);
+
+/* Returns the glyph for Codepoint, rasterizing it if it's not in the atlas.
+ * A glyph that doesn't fit this frame has an empty Rect, 0 is returned if
+ * every glyph is drawn this frame. */
+ui_glyph *UI_GetGlyph(ui_glyph_cache *Cache, unsigned int Codepoint);
+
+/* Width of Length bytes of UTF-8 text, e.g. for MeasureText. Glyphs that
+ * aren't in the atlas are measured without rasterizing them. */
+int UI_MeasureGlyphs(ui_glyph_cache *Cache, char *Text, int Length);
+
+void UI_ReleaseGlyphCache(ui_glyph_cache *Cache);
+
+#endif